@@ -0,0 +1,605 @@
+// End-to-end benchmark for joynosleep.
+//
+// Creates virtual gamepads with uinput, starts a private dbus-daemon with
+// a stub org.freedesktop.ScreenSaver, runs joynosleep against them and feeds
+// the pads with analog noise and periodic button presses.
+// Reports daemon CPU time, context switches, read syscalls per input event
+// and press-to-Inhibit latency. Buttons can be held down for a while, to compare
+// streamed events, counted on release, with --poll, which only sees held buttons.
+// The stub can also blank the screen now and then, which the next press must undo
+// with SimulateUserActivity, even though the pads are parked by then.
+// With a short deadline the inhibit must be kept as long as presses keep coming,
+// each time the daemon unparks the pads and collects what they queued.
+//
+// Needs write access to /dev/uinput and a running udev, which tags
+// the virtual pads with ID_INPUT_JOYSTICK.
+
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SAVER       "org.freedesktop.ScreenSaver"
+#define SAVER_PATH  "/org/freedesktop/ScreenSaver"
+
+#define MAX_PADS    1024
+#define MAX_SAMPLES 1024
+
+#define cleanup(f) __attribute__((cleanup(f)))
+#define unused __attribute__ ((unused))
+
+typedef struct proc_stats {
+    uint64_t utime;     // usec
+    uint64_t stime;     // usec
+    uint64_t vcsw;      // voluntary context switches
+    uint64_t ivcsw;     // involuntary context switches
+    uint64_t syscr;     // read syscalls
+    uint64_t syscw;     // write syscalls
+} proc_stats;
+
+// command line
+static unsigned n_pads      = 4;
+static unsigned rate        = 1000;     // analog events per second per pad
+static unsigned duration    = 10;       // seconds
+static unsigned press_ms    = 500;      // button press interval per pad
+static unsigned hold_ms     = 0;        // time between button down and up
+static unsigned cycles      = 0;        // screen saver restarts during the run
+static unsigned settle_ms   = 1000;     // time for udev and daemon to pick up pads
+static int hotplug          = 0;        // create pads after the daemon has started
+static unsigned blank_ms    = 0;        // screen saver activation interval, 0 never
+static int keep             = 0;        // fail if the inhibit is released during the run
+
+static int g_pads[MAX_PADS];
+static uint64_t g_release[MAX_PADS];    // tick to let the button go up at, 0 if it is not down
+static uint64_t g_sent;                 // input events written to pads
+static uint64_t g_presses;
+
+static uint64_t g_pending_press;        // first press written since screen saver (re)appeared
+static uint64_t g_latency[MAX_SAMPLES];
+static size_t n_latency;
+
+static int g_active;                    // screen is blanked
+static uint64_t g_pending_wake;         // first press written since the screen blanked
+static uint64_t g_wake_latency[MAX_SAMPLES];
+static size_t n_wake_latency;
+static uint64_t n_blank;
+
+static uint64_t n_inhibit;
+static uint64_t n_uninhibit;
+static uint32_t g_cookie;
+
+static uint64_t
+now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int
+pad_create(unsigned n) {
+    int fd = open("/dev/uinput", O_WRONLY|O_NONBLOCK|O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_KEYBIT, BTN_SOUTH);
+    ioctl(fd, UI_SET_KEYBIT, BTN_EAST);
+    ioctl(fd, UI_SET_KEYBIT, BTN_START);
+
+    ioctl(fd, UI_SET_EVBIT, EV_ABS);
+    static const int axes[] = { ABS_X, ABS_Y, ABS_RX, ABS_RY };
+    for (size_t i = 0; i < sizeof(axes) / sizeof(*axes); ++i) {
+        ioctl(fd, UI_SET_ABSBIT, axes[i]);
+        // no fuzz: every noise sample must reach the daemon
+        struct uinput_abs_setup abs = {
+            .code = axes[i],
+            .absinfo = { .minimum = -32768, .maximum = 32767, .flat = 128 },
+        };
+        ioctl(fd, UI_ABS_SETUP, &abs);
+    }
+
+    struct uinput_setup setup = {
+        .id = { .bustype = BUS_VIRTUAL, .vendor = 0x4a4e, .product = 0x5350, .version = 1 },
+    };
+    snprintf(setup.name, sizeof(setup.name), "joybench pad %u", n);
+
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+        int r = -errno;
+        close(fd);
+        return r;
+    }
+    return fd;
+}
+
+static int
+pads_create(void) {
+    for (unsigned i = 0; i < n_pads; ++i) {
+        g_pads[i] = pad_create(i);
+        if (g_pads[i] < 0)
+            return g_pads[i];
+    }
+    return 0;
+}
+
+static void
+pads_destroy(void) {
+    for (unsigned i = 0; i < n_pads; ++i) {
+        ioctl(g_pads[i], UI_DEV_DESTROY);
+        close(g_pads[i]);
+    }
+}
+
+static void
+pad_write(int fd, const struct input_event *events, size_t n) {
+    if (write(fd, events, n * sizeof(*events)) < 0)
+        fprintf(stderr, "uinput write failed: %s\n", strerror(errno));
+    else
+        g_sent += n;
+}
+
+static int
+on_tick(sd_event_source *s, uint64_t usec, unused void *userdata) {
+    static uint64_t tick;
+    const uint64_t period = 1000000 / rate;
+    const uint64_t press_every = (uint64_t)press_ms * 1000 / period;
+    const uint64_t hold = (uint64_t)hold_ms * 1000 / period;
+
+    ++tick;
+    for (unsigned i = 0; i < n_pads; ++i) {
+        struct input_event ev[6] = {
+            { .type = EV_ABS, .code = ABS_X, .value = rand() % 1024 - 512 },
+            { .type = EV_ABS, .code = ABS_Y, .value = rand() % 1024 - 512 },
+            { .type = EV_SYN, .code = SYN_REPORT },
+        };
+        size_t n = 3;
+
+        // spread presses of different pads over the interval
+        if (press_every && (tick + i * press_every / n_pads) % press_every == 0) {
+            ev[n++] = (struct input_event){ .type = EV_KEY, .code = BTN_SOUTH, .value = 1 };
+            ev[n++] = (struct input_event){ .type = EV_SYN, .code = SYN_REPORT };
+            pad_write(g_pads[i], ev, n);
+            n = 0;
+            ++g_presses;
+            if (!g_pending_press && !g_cookie)
+                g_pending_press = now_usec();
+            if (g_active && !g_pending_wake)
+                g_pending_wake = now_usec();
+            g_release[i] = tick + hold;
+        }
+
+        // joynosleep acts on release, unless it polls
+        if (g_release[i] == tick) {
+            ev[n++] = (struct input_event){ .type = EV_KEY, .code = BTN_SOUTH, .value = 0 };
+            ev[n++] = (struct input_event){ .type = EV_SYN, .code = SYN_REPORT };
+            g_release[i] = 0;
+        }
+        if (n)
+            pad_write(g_pads[i], ev, n);
+    }
+
+    return sd_event_source_set_time(s, usec + period);
+}
+
+static int
+method_inhibit(sd_bus_message *m, unused void *userdata, unused sd_bus_error *ret_error) {
+    const uint64_t t = now_usec();
+    if (g_pending_press && n_latency < MAX_SAMPLES)
+        g_latency[n_latency++] = t - g_pending_press;
+    g_pending_press = 0;
+
+    ++n_inhibit;
+    g_cookie = n_inhibit;
+    return sd_bus_reply_method_return(m, "u", g_cookie);
+}
+
+static int
+method_uninhibit(sd_bus_message *m, unused void *userdata, unused sd_bus_error *ret_error) {
+    ++n_uninhibit;
+    g_cookie = 0;
+    return sd_bus_reply_method_return(m, "");
+}
+
+static int
+method_get_active(sd_bus_message *m, unused void *userdata, unused sd_bus_error *ret_error) {
+    return sd_bus_reply_method_return(m, "b", g_active);
+}
+
+static int
+method_simulate_user_activity(sd_bus_message *m, unused void *userdata,
+    unused sd_bus_error *ret_error)
+{
+    if (g_active) {
+        if (g_pending_wake && n_wake_latency < MAX_SAMPLES)
+            g_wake_latency[n_wake_latency++] = now_usec() - g_pending_wake;
+        g_pending_wake = 0;
+        g_active = 0;
+        sd_bus_emit_signal(sd_bus_message_get_bus(m), SAVER_PATH, SAVER, "ActiveChanged", "b", 0);
+    }
+    // sent without expecting a reply, this is a no-op then
+    return sd_bus_reply_method_return(m, "");
+}
+
+static const sd_bus_vtable saver_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("Inhibit", "ss", "u", method_inhibit, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("UnInhibit", "u", "", method_uninhibit, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("GetActive", "", "b", method_get_active, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("SimulateUserActivity", "", "", method_simulate_user_activity,
+        SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_SIGNAL("ActiveChanged", "b", 0),
+    SD_BUS_VTABLE_END
+};
+
+// blank the screen while the daemon holds its inhibit and has parked the pads
+static int
+on_blank(sd_event_source *s, uint64_t usec, void *userdata) {
+    if (!g_active) {
+        g_active = 1;
+        ++n_blank;
+        sd_bus_emit_signal(userdata, SAVER_PATH, SAVER, "ActiveChanged", "b", 1);
+    }
+    return sd_event_source_set_time(s, usec + (uint64_t)blank_ms * 1000);
+}
+
+// drop the screen saver name and take it back: the daemon forgets its cookie
+// and the next press yields another press-to-Inhibit sample
+static int
+on_cycle(sd_event_source *s, uint64_t usec, void *userdata) {
+    sd_bus *bus = userdata;
+    int r;
+
+    r = sd_bus_release_name(bus, SAVER);
+    if (r < 0)
+        fprintf(stderr, "Failed to release %s: %s\n", SAVER, strerror(-r));
+
+    g_cookie = 0;
+    g_pending_press = 0;
+
+    r = sd_bus_request_name(bus, SAVER, 0);
+    if (r < 0)
+        fprintf(stderr, "Failed to request %s: %s\n", SAVER, strerror(-r));
+
+    return sd_event_source_set_time(s, usec + (uint64_t)duration * 1000000 / (cycles + 1));
+}
+
+static pid_t
+spawn(char **argv, int out_fd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (out_fd >= 0)
+            dup2(out_fd, STDOUT_FILENO);
+        execvp(argv[0], argv);
+        fprintf(stderr, "Failed to run %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    return pid;
+}
+
+static int
+dbus_daemon_start(const char *daemon, pid_t *pid) {
+    int p[2];
+    if (pipe(p) < 0)
+        return -errno;
+    fcntl(p[0], F_SETFD, FD_CLOEXEC);
+
+    char fd_arg[32];
+    snprintf(fd_arg, sizeof(fd_arg), "--print-address=%d", p[1]);
+    char *argv[] = { (char *)daemon, "--session", "--nofork", fd_arg, NULL };
+
+    // the write end is inherited by dbus-daemon
+    *pid = spawn(argv, -1);
+    close(p[1]);
+    if (*pid < 0) {
+        close(p[0]);
+        return -errno;
+    }
+
+    char address[512];
+    ssize_t n = read(p[0], address, sizeof(address) - 1);
+    close(p[0]);
+    if (n <= 0)
+        return -EIO;
+
+    address[n] = 0;
+    address[strcspn(address, "\n")] = 0;
+    return setenv("DBUS_SESSION_BUS_ADDRESS", address, 1) < 0 ? -errno : 0;
+}
+
+static int
+proc_stats_read(pid_t pid, proc_stats *st) {
+    char path[64], buf[1024];
+    FILE *f;
+    memset(st, 0, sizeof(*st));
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if (!(f = fopen(path, "re")))
+        return -errno;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = 0;
+
+    // skip "pid (comm) state ppid ... cmajflt", comm may contain spaces
+    const char *p = strrchr(buf, ')');
+    unsigned long utime, stime;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                     &utime, &stime) != 2)
+        return -EINVAL;
+    const long hz = sysconf(_SC_CLK_TCK);
+    st->utime = (uint64_t)utime * 1000000 / hz;
+    st->stime = (uint64_t)stime * 1000000 / hz;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if (!(f = fopen(path, "re")))
+        return -errno;
+    while (fgets(buf, sizeof(buf), f)) {
+        sscanf(buf, "voluntary_ctxt_switches: %" SCNu64, &st->vcsw);
+        sscanf(buf, "nonvoluntary_ctxt_switches: %" SCNu64, &st->ivcsw);
+    }
+    fclose(f);
+
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    if (!(f = fopen(path, "re")))
+        return -errno;
+    while (fgets(buf, sizeof(buf), f)) {
+        sscanf(buf, "syscr: %" SCNu64, &st->syscr);
+        sscanf(buf, "syscw: %" SCNu64, &st->syscw);
+    }
+    fclose(f);
+    return 0;
+}
+
+static uint64_t
+cpu_ms(const proc_stats *a, const proc_stats *b) {
+    return ((b->utime - a->utime) + (b->stime - a->stime)) / 1000;
+}
+
+// run the loop for a while, so udev and the daemon catch up
+static void
+settle(sd_event *ev) {
+    const uint64_t t0 = now_usec();
+    while (now_usec() - t0 < (uint64_t)settle_ms * 1000)
+        sd_event_run(ev, (uint64_t)settle_ms * 1000);
+}
+
+static int
+cmp_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+report_latency(const char *what, uint64_t *samples, size_t n) {
+    if (!n) {
+        printf("%-20sno samples\n", what);
+        return;
+    }
+    qsort(samples, n, sizeof(*samples), cmp_u64);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += samples[i];
+    printf("%-20sn=%zu min=%" PRIu64 "us median=%" PRIu64 "us"
+        " avg=%" PRIu64 "us max=%" PRIu64 "us\n",
+        what, n, samples[0], samples[n / 2], sum / n, samples[n - 1]);
+}
+
+static void
+report(const proc_stats *a, const proc_stats *b, uint64_t sent) {
+    const uint64_t cpu = (b->utime - a->utime) + (b->stime - a->stime);
+    const uint64_t reads = b->syscr - a->syscr;
+
+    printf("pads:               %u x %u Hz, press every %u ms held for %u ms, %u s\n",
+        n_pads, rate, press_ms, hold_ms, duration);
+    printf("input events:       %" PRIu64 " (%" PRIu64 " presses)\n", sent, g_presses);
+    printf("daemon cpu:         %" PRIu64 " ms user, %" PRIu64 " ms sys, %.3f%%\n",
+        (b->utime - a->utime) / 1000, (b->stime - a->stime) / 1000,
+        100.0 * cpu / ((uint64_t)duration * 1000000));
+    printf("context switches:   %" PRIu64 " voluntary, %" PRIu64 " involuntary\n",
+        b->vcsw - a->vcsw, b->ivcsw - a->ivcsw);
+    printf("read syscalls:      %" PRIu64 ", %.4f per input event\n",
+        reads, sent ? (double)reads / sent : 0.0);
+    printf("write syscalls:     %" PRIu64 "\n", b->syscw - a->syscw);
+    printf("Inhibit/UnInhibit:  %" PRIu64 "/%" PRIu64 "\n", n_inhibit, n_uninhibit);
+    report_latency("press-to-Inhibit:", g_latency, n_latency);
+    if (blank_ms) {
+        printf("screen blanked:     %" PRIu64 " times\n", n_blank);
+        report_latency("press-to-wake:", g_wake_latency, n_wake_latency);
+    }
+}
+
+static void
+usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [options] -- joynosleep [args...]\n"
+        "  -n PADS      virtual gamepads (%u)\n"
+        "  -r HZ        analog events per second per pad (%u)\n"
+        "  -d SECONDS   measured duration (%u)\n"
+        "  -p MS        button press interval per pad, 0 to disable (%u)\n"
+        "  -k MS        hold buttons down for MS, latency is still counted from down (%u)\n"
+        "  -c CYCLES    screen saver restarts, one latency sample each (%u)\n"
+        "  -s MS        settle time before measuring (%u)\n"
+        "  -H           hotplug pads into running daemon, report add/remove cost\n"
+        "  -w MS        blank the screen every MS, fail unless presses wake it up (%u)\n"
+        "  -K           fail if the inhibit is released while presses keep coming\n"
+        "  -b PATH      dbus-daemon binary (dbus-daemon)\n",
+        argv0, n_pads, rate, duration, press_ms, hold_ms, cycles, settle_ms, blank_ms);
+}
+
+int
+main(int argc, char **argv) {
+    const char *dbus_daemon = "dbus-daemon";
+    int c, r;
+
+    while ((c = getopt(argc, argv, "n:r:d:p:k:c:s:b:w:KHh")) != -1) {
+        switch (c) {
+            case 'n': n_pads = strtoul(optarg, NULL, 0); break;
+            case 'r': rate = strtoul(optarg, NULL, 0); break;
+            case 'd': duration = strtoul(optarg, NULL, 0); break;
+            case 'p': press_ms = strtoul(optarg, NULL, 0); break;
+            case 'k': hold_ms = strtoul(optarg, NULL, 0); break;
+            case 'c': cycles = strtoul(optarg, NULL, 0); break;
+            case 's': settle_ms = strtoul(optarg, NULL, 0); break;
+            case 'b': dbus_daemon = optarg; break;
+            case 'H': hotplug = 1; break;
+            case 'w': blank_ms = strtoul(optarg, NULL, 0); break;
+            case 'K': keep = 1; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (optind >= argc || !n_pads || n_pads > MAX_PADS || !rate || rate > 1000000 || !duration
+        || (press_ms && hold_ms >= press_ms)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (!hotplug && (r = pads_create()) < 0) {
+        fprintf(stderr, "Failed to create uinput pad: %s\n", strerror(-r));
+        return 77; // skip: no uinput access
+    }
+
+    pid_t bus_pid;
+    r = dbus_daemon_start(dbus_daemon, &bus_pid);
+    if (r < 0) {
+        fprintf(stderr, "Failed to start %s: %s\n", dbus_daemon, strerror(-r));
+        return 77;
+    }
+
+    cleanup(sd_event_unrefp) sd_event *ev = NULL;
+    cleanup(sd_bus_unrefp) sd_bus *bus = NULL;
+    r = sd_event_default(&ev);
+    assert(r >= 0);
+
+    r = sd_bus_open_user(&bus);
+    if (r < 0) {
+        fprintf(stderr, "Failed to connect to private bus: %s\n", strerror(-r));
+        return 1;
+    }
+    r = sd_bus_add_object_vtable(bus, NULL, SAVER_PATH, SAVER, saver_vtable, NULL);
+    assert(r >= 0);
+    r = sd_bus_request_name(bus, SAVER, 0);
+    if (r < 0) {
+        fprintf(stderr, "Failed to acquire %s: %s\n", SAVER, strerror(-r));
+        return 1;
+    }
+    r = sd_bus_attach_event(bus, ev, SD_EVENT_PRIORITY_NORMAL);
+    assert(r >= 0);
+
+    // give udev time to tag the pads before daemon enumerates them
+    if (!hotplug)
+        usleep(settle_ms * 1000);
+
+    int devnull = open("/dev/null", O_WRONLY|O_CLOEXEC);
+    pid_t pid = spawn(argv + optind, devnull);
+    if (pid < 0) {
+        fprintf(stderr, "Failed to start %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+
+    // let the daemon start and answer its NameHasOwner
+    settle(ev);
+
+    proc_stats before, after;
+    if (hotplug) {
+        proc_stats_read(pid, &before);
+        if ((r = pads_create()) < 0) {
+            fprintf(stderr, "Failed to create uinput pad: %s\n", strerror(-r));
+            kill(pid, SIGTERM);
+            kill(bus_pid, SIGTERM);
+            return 77;
+        }
+        settle(ev);
+        proc_stats_read(pid, &after);
+        printf("hotplug add:        %u pads, daemon cpu %" PRIu64 " ms\n",
+            n_pads, cpu_ms(&before, &after));
+    }
+
+    r = proc_stats_read(pid, &before);
+    if (r < 0)
+        fprintf(stderr, "Failed to read daemon stats: %s\n", strerror(-r));
+
+    // periodic timers: sources are created one-shot, handlers move them forward
+    sd_event_source *s;
+    const uint64_t start = now_usec();
+    r = sd_event_add_time(ev, &s, CLOCK_MONOTONIC, start, 1, on_tick, NULL);
+    assert(r >= 0);
+    sd_event_source_set_enabled(s, SD_EVENT_ON);
+    sd_event_source_set_floating(s, 1);
+    sd_event_source_unref(s);
+    if (cycles) {
+        r = sd_event_add_time(ev, &s, CLOCK_MONOTONIC,
+            start + (uint64_t)duration * 1000000 / (cycles + 1), 1, on_cycle, bus);
+        assert(r >= 0);
+        sd_event_source_set_enabled(s, SD_EVENT_ON);
+        sd_event_source_set_floating(s, 1);
+        sd_event_source_unref(s);
+    }
+    if (blank_ms) {
+        r = sd_event_add_time(ev, &s, CLOCK_MONOTONIC,
+            start + (uint64_t)blank_ms * 1000, 1, on_blank, bus);
+        assert(r >= 0);
+        sd_event_source_set_enabled(s, SD_EVENT_ON);
+        sd_event_source_set_floating(s, 1);
+        sd_event_source_unref(s);
+    }
+    r = sd_event_add_time(ev, NULL, CLOCK_MONOTONIC,
+        start + (uint64_t)duration * 1000000, 1, NULL, NULL);
+    assert(r >= 0);
+
+    // without a handler the timer exits the loop
+    r = sd_event_loop(ev);
+    const uint64_t released = n_uninhibit;
+
+    proc_stats_read(pid, &after);
+    report(&before, &after, g_sent);
+
+    if (hotplug) {
+        proc_stats_read(pid, &before);
+        pads_destroy();
+        settle(ev);
+        proc_stats_read(pid, &after);
+        printf("hotplug remove:     %u pads, daemon cpu %" PRIu64 " ms\n",
+            n_pads, cpu_ms(&before, &after));
+    }
+
+    int status = 0;
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    kill(bus_pid, SIGTERM);
+    waitpid(bus_pid, NULL, 0);
+    if (!hotplug)
+        pads_destroy();
+
+    // e.g. aborted by a check of the test build
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "%s failed: status 0x%x\n", argv[optind], status);
+        return 1;
+    }
+
+    // the last blank may come too close to the end to see a press
+    if (blank_ms && n_wake_latency + 1 < n_blank) {
+        fprintf(stderr, "%s woke the screen %zu times of %" PRIu64 "\n",
+            argv[optind], n_wake_latency, n_blank);
+        return 1;
+    }
+
+    if (keep && released) {
+        fprintf(stderr, "%s released the inhibit %" PRIu64 " times while pressed\n",
+            argv[optind], released);
+        return 1;
+    }
+    return 0;
+}
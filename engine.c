@@ -0,0 +1,387 @@
+#include "engine.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+
+static int64_t
+distance(int32_t a, int32_t b) {
+    const int64_t d = (int64_t)a - b;
+    return d < 0 ? -d : d;
+}
+
+int
+input_axis_add(input *in, unsigned code, const struct input_absinfo *info,
+    int deadzone, int threshold)
+{
+    assert(code < ABS_CNT);
+    if (!in->axes && !(in->axes = calloc(1, sizeof(*in->axes))))
+        return -ENOMEM;
+
+    // percents of the range, but hats are only -1..1 and must still count
+    const int64_t range = (int64_t)info->maximum - info->minimum;
+    const int64_t dz = range * deadzone / 100;
+    const int64_t th = range * threshold / 100;
+    axes *a = in->axes;
+    a->tracked |= 1ULL << code;
+    a->value[code] = a->ref[code] = a->rest[code] = info->value;
+    a->deadzone[code] = dz > info->flat ? dz : info->flat;
+    a->threshold[code] = th > 0 ? th : 1;
+    return 0;
+}
+
+// checks axes which got events in the last batch and moves their reference points.
+// small jitter around ref never adds up, since ref only follows real movements.
+static int
+axes_moved(axes *a, uint64_t touched) {
+    int moved = 0;
+
+    for (touched &= a->tracked; touched; touched &= touched - 1) {
+        const int c = __builtin_ctzll(touched);
+        const int32_t v = a->value[c];
+        if (distance(v, a->ref[c]) < a->threshold[c])
+            continue;
+        // stick noise near rest position is not activity, but returning to it is
+        if (distance(v, a->rest[c]) <= a->deadzone[c] && distance(a->ref[c], a->rest[c]) <= a->deadzone[c])
+            continue;
+        a->ref[c] = v;
+        moved = 1;
+    }
+
+    return moved;
+}
+
+static void
+chatter_quarantine(chatter *ch, uint64_t t) {
+    ch->changed = 1;
+    // codes found later join the quarantine in progress
+    if (ch->until)
+        return;
+
+    // a button which chattered once gets a clean record back with time
+    if (ch->delay && t - ch->lifted >= ch->delay)
+        ch->delay = 0;
+    ch->delay = ch->delay ? ch->delay * 2 : CHATTER_RECHECK_MIN;
+    if (ch->delay > CHATTER_RECHECK_MAX)
+        ch->delay = CHATTER_RECHECK_MAX;
+    ch->until = t + ch->delay;
+    ++ch->n_quarantines;
+}
+
+static void
+chatter_lift(chatter *ch, uint64_t t) {
+    for (size_t i = 0; i < NLONGS(KEY_CNT); ++i)
+        ch->noisy[i] = 0;
+    ch->until = 0;
+    ch->lifted = t;
+    ch->changed = 1;
+}
+
+// events of a frame share its timestamp: buttons released together are one frame.
+// returns 1 if the ring of frames took less time than fingers need.
+static int
+chatter_frame(chatter *ch, uint64_t t) {
+    const unsigned last = (ch->frames - 1) % CHATTER_RING;
+    if (ch->frames && ch->frame[last] == t)
+        return 0;
+
+    const unsigned h = ch->frames++ % CHATTER_RING;
+    ch->frame[h] = t;
+    // keep it from wrapping to an empty ring
+    if (ch->frames == 2 * CHATTER_RING)
+        ch->frames = CHATTER_RING;
+    return ch->frames >= CHATTER_RING
+        && t - ch->frame[(h + 1) % CHATTER_RING] < (CHATTER_RING - 1) * CHATTER_RATE;
+}
+
+// adds a press to the rings and looks back at them. a human press costs a couple of
+// comparisons: the intervals of its code stop being steady right away.
+static void
+chatter_press(chatter *ch, unsigned code, uint64_t t) {
+    // quarantine the whole device
+    if (chatter_frame(ch, t)) {
+        for (size_t i = 0; i < NLONGS(KEY_CNT); ++i)
+            ch->noisy[i] = ~0UL;
+        ch->head = ch->frames = 0;
+        chatter_quarantine(ch, t);
+        return;
+    }
+
+    const unsigned n = ch->head < CHATTER_RING ? ch->head + 1 : CHATTER_RING;
+    const unsigned h = ch->head++ % CHATTER_RING;
+    ch->usec[h] = t;
+    ch->code[h] = code;
+    if (ch->head == 2 * CHATTER_RING)
+        ch->head = CHATTER_RING;
+
+    uint64_t last = t, min = UINT64_MAX, max = 0;
+    unsigned found = 1;
+    for (unsigned i = 1; i < n && found < CHATTER_PERIODIC; ++i) {
+        const unsigned k = (h - i) % CHATTER_RING;
+        if (ch->code[k] != code)
+            continue;
+        const uint64_t interval = last - ch->usec[k];
+        if (interval < min)
+            min = interval;
+        if (interval > max)
+            max = interval;
+        if (max - min > CHATTER_JITTER)
+            return;
+        last = ch->usec[k];
+        ++found;
+    }
+
+    if (found == CHATTER_PERIODIC) {
+        ch->noisy[code / BITS_PER_LONG] |= 1UL << (code % BITS_PER_LONG);
+        chatter_quarantine(ch, t);
+    }
+}
+
+uint64_t
+input_classify(input *in, const struct input_event *events, size_t count) {
+    uint64_t pressed = 0, moved = 0;
+    uint64_t touched = 0;
+
+    ++in->n_reads;
+    in->n_events += count;
+    for (size_t i = 0; i < count; ++i) {
+        const struct input_event *e = &events[i];
+        if (in->dropping) {
+            // events up to the next report are what survived the overflow, input_resync()
+            // catches up with all of it at once
+            if (e->type == EV_SYN && e->code == SYN_REPORT)
+                in->dropping = 0;
+            continue;
+        }
+
+        if (e->type == EV_KEY && e->code < KEY_CNT) {
+            const unsigned long bit = 1UL << (e->code % BITS_PER_LONG);
+            if (e->value)
+                in->keys[e->code / BITS_PER_LONG] |= bit;
+            else {
+                // buttons count on release
+                in->keys[e->code / BITS_PER_LONG] &= ~bit;
+                const uint64_t t = event_usec(e);
+                if (in->chatter.until && t >= in->chatter.until)
+                    chatter_lift(&in->chatter, t);
+                if (test_bit(in->chatter.noisy, e->code)) {
+                    ++in->chatter.n_ignored;
+                    continue;
+                }
+                ++in->n_presses;
+                pressed = t;
+                chatter_press(&in->chatter, e->code, t);
+            }
+        } else if (e->type == EV_ABS && in->axes && e->code < ABS_CNT) {
+            in->axes->value[e->code] = e->value;
+            touched |= 1ULL << e->code;
+            moved = event_usec(e);
+        } else if (e->type == EV_SYN && e->code == SYN_DROPPED) {
+            ++in->n_dropped;
+            in->dropping = 1;
+            in->dropped = event_usec(e);
+            // intervals across the gap mean nothing
+            in->chatter.head = in->chatter.frames = 0;
+            // a masked device only queues key events, so overflow means buttons were pressed
+            // even if they are back where they were
+            if (in->masked && !in->axes)
+                pressed = in->dropped;
+        }
+    }
+
+    if (touched && axes_moved(in->axes, touched) && moved > pressed)
+        pressed = moved;
+
+    return pressed;
+}
+
+uint64_t
+input_resync(input *in, const unsigned long *keys) {
+    unsigned long changed = 0;
+
+    for (size_t i = 0; i < NLONGS(KEY_CNT); ++i) {
+        const unsigned long diff = (keys[i] ^ in->keys[i]) & ~in->chatter.noisy[i];
+        // keys seen down and up now were released in the overflow, that is a press.
+        // new ones are counted when they come up.
+        const int missed = __builtin_popcountl(diff & in->keys[i]);
+        in->n_missed += missed;
+        in->n_presses += missed;
+        in->keys[i] = keys[i];
+        changed |= diff;
+    }
+
+    const uint64_t t = in->dropped;
+    in->dropped = 0;
+    return changed ? t : 0;
+}
+
+uint64_t
+input_sample(input *in, const unsigned long *keys, uint64_t now) {
+    unsigned long changed = 0;
+
+    ++in->n_reads;
+    for (size_t i = 0; i < NLONGS(KEY_CNT); ++i) {
+        const unsigned long diff = keys[i] ^ in->keys[i];
+        in->n_presses += __builtin_popcountl(diff & in->keys[i]);
+        in->keys[i] = keys[i];
+        changed |= diff;
+    }
+
+    if (in->axes && axes_moved(in->axes, in->axes->tracked))
+        changed = 1;
+
+    return changed ? now : 0;
+}
+
+int
+input_recheck(input *in, uint64_t now) {
+    if (!in->chatter.until || now < in->chatter.until)
+        return 0;
+
+    chatter_lift(&in->chatter, now);
+    return 1;
+}
+
+void
+policy_init(policy *p, uint64_t timeout) {
+    *p = (policy){ .timeout = timeout };
+}
+
+int
+policy_idle(const policy *p) {
+    return p->state == SAVER_IDLE && !p->want_inhibit;
+}
+
+void
+policy_press(policy *p, uint64_t t) {
+    if (t > p->last_press)
+        p->last_press = t;
+}
+
+unsigned
+policy_activity(policy *p) {
+    // timer is already armed, policy_timer() will take the new deadline into account
+    if (p->want_inhibit && p->armed)
+        return 0;
+
+    p->want_inhibit = 1;
+    p->armed = 1;
+    p->timer = p->last_press + p->timeout;
+    return POLICY_ARM;
+}
+
+unsigned
+policy_timer(policy *p, uint64_t now) {
+    assert(p->want_inhibit);
+
+    // buttons were pressed since the timer was armed: sleep until the new deadline
+    p->armed = 0;
+    const uint64_t deadline = p->last_press + p->timeout;
+    if (deadline > now) {
+        p->armed = 1;
+        p->timer = deadline;
+        return POLICY_ARM;
+    }
+
+    p->want_inhibit = 0;
+    return 0;
+}
+
+unsigned
+policy_sync(policy *p, int available, int usable) {
+    // backing off after a failed call, policy_retry() comes first
+    if (p->retrying)
+        return 0;
+
+    switch (p->state) {
+        case SAVER_IDLE:
+            // without an inhibitor the press is only remembered,
+            // the caller syncs again once one appears
+            if (p->want_inhibit && available) {
+                p->state = SAVER_INHIBITING;
+                return POLICY_INHIBIT;
+            }
+            break;
+        case SAVER_INHIBITED:
+            // the inhibitor might not be allowed anymore, another one takes over after release
+            if (!p->want_inhibit || !usable) {
+                p->state = SAVER_RELEASING;
+                return POLICY_RELEASE;
+            }
+            break;
+        case SAVER_INHIBITING:
+        case SAVER_RELEASING:
+            // a call is in flight, its completion is reported first
+            break;
+    }
+
+    return 0;
+}
+
+static unsigned
+policy_backoff(policy *p) {
+    p->retry_delay = p->retry_delay ? p->retry_delay * 2 : POLICY_RETRY_MIN;
+    if (p->retry_delay > POLICY_RETRY_MAX)
+        p->retry_delay = POLICY_RETRY_MAX;
+    p->retrying = 1;
+    return POLICY_RETRY;
+}
+
+unsigned
+policy_inhibited(policy *p, int ok) {
+    assert(p->state == SAVER_INHIBITING);
+    if (!ok) {
+        p->state = SAVER_IDLE;
+        return policy_backoff(p);
+    }
+
+    p->state = SAVER_INHIBITED;
+    p->retry_delay = 0;
+    return 0;
+}
+
+unsigned
+policy_released(policy *p, int ok) {
+    assert(p->state == SAVER_RELEASING);
+    if (!ok) {
+        p->state = SAVER_INHIBITED;
+        return policy_backoff(p);
+    }
+
+    p->state = SAVER_IDLE;
+    p->retry_delay = 0;
+    return 0;
+}
+
+unsigned
+policy_failed(policy *p) {
+    assert(p->state == SAVER_INHIBITING || p->state == SAVER_RELEASING);
+    p->state = p->state == SAVER_INHIBITING ? SAVER_IDLE : SAVER_INHIBITED;
+    return policy_backoff(p);
+}
+
+void
+policy_retry(policy *p) {
+    p->retrying = 0;
+}
+
+void
+policy_forget(policy *p) {
+    p->state = SAVER_IDLE;
+}
+
+void
+policy_reset(policy *p) {
+    policy_init(p, p->timeout);
+}
+
+unsigned
+policy_set_timeout(policy *p, uint64_t timeout) {
+    p->timeout = timeout;
+    // a shorter timeout may move the deadline closer than the armed timer
+    if (!p->want_inhibit || !p->armed)
+        return 0;
+
+    p->timer = p->last_press + p->timeout;
+    return POLICY_ARM;
+}
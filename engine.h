@@ -0,0 +1,170 @@
+#pragma once
+
+// inhibit policy and input classification of joynosleep, free of event loop and bus.
+// everything is driven by timestamps passed in, so it runs the same on a simulated clock.
+
+#include <linux/input.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BITS_PER_LONG (8 * sizeof(long))
+#define NLONGS(n) (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+// analog axes are tracked per batch: events only store the latest value,
+// movement is judged once per read against the value of the last movement.
+typedef struct axes {
+    uint64_t tracked;               // bitmask of ABS codes unmasked in kernel
+    int32_t value[ABS_CNT];         // latest value read
+    int32_t ref[ABS_CNT];           // value at the last detected movement
+    int32_t rest[ABS_CNT];          // value when the device was added: center of sticks, released pedals
+    int32_t deadzone[ABS_CNT];      // distance from rest which is noise
+    int32_t threshold[ABS_CNT];     // distance from ref which is movement
+} axes;
+
+#define CHATTER_RING        32          // presses looked back at, a power of 2
+#define CHATTER_PERIODIC    8           // presses of a code at a steady period make it noisy
+#define CHATTER_JITTER      2000        //  2ms: spread of their intervals, fingers can't do better
+#define CHATTER_RATE        20000       // 20ms: average interval of a ring of frames, ditto
+#define CHATTER_RECHECK_MIN 60000000    //  1min
+#define CHATTER_RECHECK_MAX 3600000000  //  1h
+
+// recent presses of a device, to spot the ones nobody makes: a worn or cheap encoder
+// toggling a code at a steady period, or a device pressing faster than fingers can.
+// the rate is counted in frames with presses, so chords don't add up.
+// presses of quarantined codes are ignored until the quarantine is lifted,
+// then they get another chance with a quarantine twice as long if they are still noisy.
+// a device which stays clean for as long as its last quarantine starts over.
+typedef struct chatter {
+    uint64_t usec[CHATTER_RING];
+    uint16_t code[CHATTER_RING];
+    unsigned head;                      // presses in the ring since it was reset, not wrapped
+    uint64_t frame[CHATTER_RING];       // timestamps of the last frames with presses
+    unsigned frames;                    // the same as head
+    unsigned long noisy[NLONGS(KEY_CNT)]; // quarantined codes, all of them if it is the device
+    int changed;                        // noisy changed, the caller updates kernel mask if it has one
+    uint64_t until;                     // quarantine is lifted at this time, 0 if none
+    uint64_t delay;                     // length of the last quarantine
+    uint64_t lifted;                    // when it was lifted
+    uint64_t n_ignored;                 // presses of noisy codes
+    uint64_t n_quarantines;
+} chatter;
+
+// what is known about events of one device
+typedef struct input {
+    uint64_t n_events;
+    uint64_t n_presses;
+    uint64_t n_dropped; // SYN_DROPPED: kernel queue overflows
+    uint64_t n_missed;  // presses lost in overflows, found by input_resync()
+    uint64_t n_reads;
+    int masked;         // kernel filters out everything but EV_KEY and tracked axes
+    axes *axes;         // NULL unless axis detection is enabled and device has any
+    int dropping;       // the rest of the frame after SYN_DROPPED is discarded
+    uint64_t dropped;   // timestamp of SYN_DROPPED waiting for input_resync(), 0 if none
+    unsigned long keys[NLONGS(KEY_CNT)]; // key state as seen in events
+    chatter chatter;
+} input;
+
+static inline int
+test_bit(const unsigned long *bits, unsigned bit) {
+    return (bits[bit / BITS_PER_LONG] >> (bit % BITS_PER_LONG)) & 1;
+}
+
+static inline uint64_t
+event_usec(const struct input_event *event) {
+    return (uint64_t)event->input_event_sec * 1000000 + event->input_event_usec;
+}
+
+// starts tracking axis code with the range and resting value from info.
+// deadzone and threshold are percents of the range. -ENOMEM on failure.
+int input_axis_add(input *in, unsigned code, const struct input_absinfo *info,
+    int deadzone, int threshold);
+
+// returns timestamp of the last button press or axis movement in a batch of events, 0 if none.
+// after SYN_DROPPED, input.dropped is set until the caller passes current key state
+// (EVIOCGKEY) to input_resync(). presses of noisy codes don't count, see chatter.
+uint64_t input_classify(input *in, const struct input_event *events, size_t count);
+
+// compares keys with the state seen in events. returns the time of the overflow
+// if any key changed in it, 0 otherwise.
+uint64_t input_resync(input *in, const unsigned long *keys);
+
+// compares a snapshot of key state, and axes.value filled by the caller, with the previous one.
+// without events quick presses may come and go unseen, and a held button is as good as
+// a press: any key going down or up, or an axis movement, is activity.
+// returns now if there was any, 0 otherwise.
+uint64_t input_sample(input *in, const unsigned long *keys, uint64_t now);
+
+// lifts the quarantine if it is due by now, returns 1 if it did.
+// presses lift it too, this is for devices whose noisy codes are masked in kernel.
+int input_recheck(input *in, uint64_t now);
+
+typedef enum saver_state {
+    SAVER_IDLE,         // screen saver is not inhibited
+    SAVER_INHIBITING,   // Inhibit call is in flight
+    SAVER_INHIBITED,    // seat inhibitor holds the inhibition
+    SAVER_RELEASING,    // UnInhibit call is in flight
+} saver_state;
+
+#define POLICY_RETRY_MIN  1000000 //  1s
+#define POLICY_RETRY_MAX 60000000 //  1min
+
+// inhibit state of a seat. want_inhibit is what joysticks ask for, state is what
+// screen saver has. the caller owns timers and inhibit calls: it reports what happened
+// with policy_*() functions and carries out the POLICY_* actions they return.
+typedef struct policy {
+    uint64_t timeout;           // inhibit for this long after the last press
+    saver_state state;
+    int want_inhibit;
+    // time of the last button press. presses only update it,
+    // the timer is re-armed lazily by policy_timer().
+    uint64_t last_press;
+    int armed;                  // deadline timer is armed to fire at timer
+    uint64_t timer;
+    uint64_t retry_delay;       // backoff after a failed call
+    int retrying;               // no calls until policy_retry()
+} policy;
+
+enum {
+    POLICY_ARM     = 1 << 0,    // arm the deadline timer at policy.timer
+    POLICY_INHIBIT = 1 << 1,    // start an inhibit call, report it with policy_inhibited()
+    POLICY_RELEASE = 1 << 2,    // start an uninhibit call, report it with policy_released()
+    POLICY_RETRY   = 1 << 3,    // call policy_retry() in policy.retry_delay
+};
+
+void policy_init(policy *p, uint64_t timeout);
+
+// inhibition is neither held nor wanted
+int policy_idle(const policy *p);
+
+// a button was pressed at t. it only moves the deadline, see policy_activity()
+void policy_press(policy *p, uint64_t t);
+
+// presses were seen, inhibit until the last one plus timeout
+unsigned policy_activity(policy *p);
+
+// the deadline timer fired at now
+unsigned policy_timer(policy *p, uint64_t now);
+
+// moves state towards want_inhibit. available tells if there is anything to inhibit with,
+// usable if the inhibitor holding the inhibition is still allowed.
+unsigned policy_sync(policy *p, int available, int usable);
+
+// an inhibit or uninhibit call completed, ok is 0 if it failed
+unsigned policy_inhibited(policy *p, int ok);
+unsigned policy_released(policy *p, int ok);
+
+// an inhibit or uninhibit call couldn't even be started
+unsigned policy_failed(policy *p);
+
+// the retry timer fired, or couldn't be armed
+void policy_retry(policy *p);
+
+// inhibition is gone along with the inhibitor, nothing to release
+void policy_forget(policy *p);
+
+// forget about the inhibition and presses
+void policy_reset(policy *p);
+
+// timeout changed, the armed deadline moves with it
+unsigned policy_set_timeout(policy *p, uint64_t timeout);
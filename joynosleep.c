@@ -1,524 +1,3452 @@
 #include <systemd/sd-bus.h>
 #include <systemd/sd-device.h>
 #include <systemd/sd-event.h>
+#include <systemd/sd-login.h>
 
 #include <linux/input.h>
 
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <sys/eventfd.h>
+#endif
+
+#ifdef HAVE_X11
+#include <X11/Xlib.h>
+#include <X11/extensions/scrnsaver.h>
+#endif
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#endif
+
 #include <assert.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "engine.h"
+
 #define PROJECT_NAME "joynosleep"
 #define SAVER       "org.freedesktop.ScreenSaver"
 #define SAVER_PATH  "/org/freedesktop/ScreenSaver"
 
+#define GNOME_SM      "org.gnome.SessionManager"
+#define GNOME_SM_PATH "/org/gnome/SessionManager"
+#define GNOME_SM_IDLE 8 // GSM_INHIBITOR_FLAG_IDLE
+
+#define LOGIN         "org.freedesktop.login1"
+#define LOGIN_PATH    "/org/freedesktop/login1"
+#define LOGIN_MANAGER "org.freedesktop.login1.Manager"
+
 #define DBUS        "org.freedesktop.DBus"
 #define DBUS_PATH   "/org/freedesktop/DBus"
 
-// to keep everything simple, use static buffer for tracked joysticks.
-// there are not many games (even for arcades) that support more than 4 players,
-// so current limit is already too generous.
-#define MAX_JOYSTICKS 16
+#define METRICS      "io.github.ksv1986.Joynosleep"
+#define METRICS_PATH "/io/github/ksv1986/Joynosleep"
+
+// events pulled from a joystick fd with a single read().
+// one frame of a gamepad is a handful of EV_ABS plus EV_SYN, so this
+// is usually enough to drain everything queued since the last wakeup.
+#define READ_BATCH 64
+
+// static tracepoints for perf and bpftrace, see README.
+// a probe is a single nop until a tracer attaches to it.
+#ifdef HAVE_SDT
+#define PROBE(...) STAP_PROBEV(joynosleep, __VA_ARGS__)
+#else
+#define PROBE(...) do {} while (0)
+#endif
 
 #define cleanup(f) __attribute__((cleanup(f)))
 #define unused __attribute__ ((unused))
 
+static inline void
+fclosep(FILE **f) {
+    if (*f)
+        fclose(*f);
+}
+
+static inline void
+freep(void *p) {
+    free(*(void **)p);
+}
+
+typedef struct seat seat;
+
 typedef struct joystick {
     sd_device *dev;
+    seat *seat;
+    dev_t devnum;
     const char *devname;
     const char *name;
     sd_event_source *source;
-    uint64_t n_events;
+    input input;
+    int monotonic; // kernel timestamps events with CLOCK_MONOTONIC
+    int parked;    // not polled until the inhibit deadline
+    int polled;    // state is sampled by g_poll instead of reading events
+    uint64_t n_wakeups;
 } joystick;
 
-static sd_bus *g_bus;
-static sd_device_monitor *g_monitor;
-static uint32_t g_cookie;
+typedef struct inhibitor inhibitor;
 
-static const uint64_t accuracy    =  60000000; //  1min
-static uint64_t g_inhibit_timeout = 600000000; // 10min
-static sd_event_source *g_timer;
+// a way to keep screen saver off. inhibit() and uninhibit() either start a bus call,
+// whose reply handler reports back with saver_inhibited()/saver_released(),
+// or are done right away and return 1.
+struct inhibitor {
+    const char *name;
+    const char *service;    // bus name providing it, NULL if it is not on a bus
+    int system;             // service is on the system bus
+    int oneway;             // uninhibit() needs no reply, so it works without the service
+    int (*inhibit)(seat *s, const char *reason);
+    int (*uninhibit)(seat *s);
+    uint64_t n_calls;       // inhibit and uninhibit round trips
+    uint64_t call_usec;
+    uint64_t call_max;
+};
+
+// in order of preference for `inhibitor = auto`: what the desktop blanking the screen
+// listens to first, then the fewer round trips, the better
+#ifdef HAVE_X11
+#define N_INHIBITORS 4
+#define INHIBITOR_X11 2
+#else
+#define N_INHIBITORS 3
+#endif
+static inhibitor g_inhibitors[N_INHIBITORS];
+
+// inhibit state of a seat. in session mode there is just one, for our own session.
+// in system mode there is one per logind seat, talking to the bus of its active session.
+// bus calls are asynchronous, so the event loop never waits for screen saver.
+// policy decides, the saver_*() functions carry out its decisions one call at a time.
+struct seat {
+    char *name;                 // logind seat, NULL in session mode
+    sd_bus *bus;                // where session inhibitors are called
+    char *session;              // active session, system mode only
+    unsigned present;           // bitmask of g_inhibitors found
+    policy policy;              // in CLOCK_MONOTONIC
+    inhibitor *inhibitor;       // the one holding the inhibition or a call in flight
+    sd_bus_slot *call;
+    uint64_t call_start;
+    uint32_t cookie;
+    int fd;
+    sd_event_source *retry;     // armed on POLICY_RETRY
+    sd_event_source *timer;     // armed on POLICY_ARM
+    uint64_t latency_press;     // see g_latency
+    int active;                 // screen saver is blanking or locking the screen
+    uint64_t wake_press;        // see g_wake_latency, 0 if not waking up
+    uint64_t inhibited_since;   // 0 if not inhibited
+};
+
+#define MAX_SEATS 32
+static seat g_seats[MAX_SEATS];
+static size_t n_seats;
 
-static joystick g_joysticks[MAX_JOYSTICKS];
+static sd_bus *g_bus;
+static sd_bus *g_system_bus;
+static sd_device_monitor *g_monitor;
+static const char *g_udev_tag;
+static int g_saver_present;     // any seat has an allowed inhibitor
+
+static const uint64_t call_timeout =  5000000; //  5s
+
+#define MAX_IGNORE    16
+#define MAX_OVERRIDES 64
+
+typedef struct config {
+    uint64_t timeout;           // inhibit screen saver for this long after the last press
+    uint64_t accuracy;          // timer slack, lets kernel coalesce our wakeups with others
+    int park;                   // stop polling joysticks between a press and the deadline
+    int uring;                  // read joysticks with io_uring instead of epoll, at startup only
+    int axes;                   // count analog axis movements as activity
+    int deadzone;               // percent of axis range around rest position that is ignored
+    int threshold;              // percent of axis range an axis has to move to count
+    int inhibitor;              // index in g_inhibitors plus one, 0 picks any present
+    uint64_t exit_idle;         // exit after this long without joysticks and inhibition, 0 never
+    int system;                 // serve every seat from a system service, at startup only
+    uint64_t poll;              // sample joystick state this often instead of reading events, 0 never.
+                                // switching between the two takes a restart
+    size_t n_ignore;
+    char *ignore[MAX_IGNORE];   // fnmatch patterns of device names or nodes
+} config;
+
+static const config config_defaults = {
+    .timeout   = 600000000, // 10min
+    .accuracy  =  60000000, //  1min
+    .park      = 1,
+    .deadzone  = 10,
+    .threshold = 5,
+};
+
+// config file is re-read on SIGHUP. command line options override it,
+// so they are kept as key=value pairs and applied on top of every reload.
+static config g_config;
+static const char *g_config_path;
+static int g_config_required;
+static const char *g_overrides[MAX_OVERRIDES][2];
+static size_t n_overrides;
+
+static sd_event_source *g_idle;
+
+// --record appends every batch read to g_record_fd.
+// --replay runs them through the same code on a virtual clock, see replay().
+static const char *g_record_path;
+static const char *g_replay_path;
+static int g_record_fd = -1;
+static int g_replay;
+static uint64_t g_replay_now;
+
+// --status-fd and --status-fifo get a JSON line per state transition, for status bars.
+// each line has the whole state of its seat, so readers only need the last one.
+static int g_status_fd = -1;
+static const char *g_status_fifo;
+
+// tracked joysticks are kept in a dense array, so removal is a cheap swap with the last one.
+// io sources point to their entries, so they are updated whenever entries move.
+static joystick *g_joysticks;
 static size_t n_joysticks;
+static size_t g_joysticks_size;
+
+// open addressing hash of devnum to index in g_joysticks plus one, 0 marks empty slot.
+// it is kept at most half full, so a lookup takes a probe or two.
+static uint32_t *g_index;
+static size_t g_index_size;
+
+typedef struct metrics {
+    uint64_t n_inhibit;
+    uint64_t n_uninhibit;
+    uint64_t inhibited_usec;    // total time seats were inhibited, without current periods
+    uint64_t n_wake;            // SimulateUserActivity calls
+    uint64_t wake_usec;         // see g_wake_latency, the last one
+} metrics;
+
+// exported on the bus as METRICS interface.
+// PropertiesChanged goes out at most once per metrics_interval.
+static metrics g_metrics;
+static const uint64_t metrics_interval = 1000000; // 1s
+static sd_event_source *g_metrics_timer;
+
+// press-to-inhibit latency: from kernel timestamp of the first press that found
+// screen saver not inhibited, to Inhibit reply. bucket i counts [2^(i-1), 2^i) usec.
+#define LATENCY_BUCKETS 40
+static uint64_t g_latency[LATENCY_BUCKETS];
+
+// press-to-wake latency: from kernel timestamp of the press which found screen saver
+// active, to ActiveChanged(false). the same buckets.
+static uint64_t g_wake_latency[LATENCY_BUCKETS];
+
+// formats a line on stack and writes it with a single syscall: no stdio buffers
+// to allocate and flush, and lines of concurrent writers never interleave.
+static void
+log_write(int fd, int error, const char *fmt, va_list va) {
+    char line[512];
+    size_t len = 0;
+
+    int n = vsnprintf(line, sizeof(line), fmt, va);
+    if (n > 0)
+        len = (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1;
+    if (error) {
+        n = snprintf(line + len, sizeof(line) - len, ": %d %s", -error, strerror(-error));
+        if (n > 0)
+            len = len + n < sizeof(line) ? len + n : sizeof(line) - 1;
+    }
+    line[len++] = '\n';
 
-static int
-log_error(int error, const char *message) {
-    const int r = -error;
-    fprintf(stderr, "%s: %d %s\n", message, r, strerror(r));
-    fflush(stderr);
-    return error;
+    // nothing sensible to do if logging fails
+    if (write(fd, line, len) < 0)
+        return;
 }
 
 static int
 log_errorf(int error, const char *fmt, ...) {
-    const int r = -error;
     va_list va;
     va_start(va, fmt);
-    vfprintf(stderr, fmt, va);
+    log_write(STDERR_FILENO, error, fmt, va);
     va_end(va);
-    fprintf(stderr, ": %d %s\n", r, strerror(r));
-    fflush(stderr);
     return error;
 }
 
-static void
-log_info(const char *line) {
-    fprintf(stdout, "%s\n", line);
-    fflush(stdout);
+static int
+log_error(int error, const char *message) {
+    return log_errorf(error, "%s", message);
 }
 
 static void
 log_infof(const char *fmt, ...) {
     va_list va;
     va_start(va, fmt);
-    vfprintf(stdout, fmt, va);
+    log_write(STDOUT_FILENO, 0, fmt, va);
     va_end(va);
-    fwrite("\n", 1, 1, stdout);
-    fflush(stdout);
 }
 
+static void
+log_info(const char *line) {
+    log_infof("%s", line);
+}
+
+#ifdef ALLOC_CHECK
+// heap allocations of the whole process, counted by tests/alloc-count.c
+extern uint64_t alloc_count;
+
+typedef struct alloc_guard {
+    uint64_t count;
+    uint64_t calls;
+    size_t n_joysticks;
+} alloc_guard;
+
+static uint64_t
+alloc_guard_calls(void) {
+    return g_metrics.n_inhibit + g_metrics.n_uninhibit + g_metrics.n_wake;
+}
+
+// input handling may only touch the heap for inhibit calls or device set changes
+static void
+alloc_guard_check(const alloc_guard *g) {
+    if (alloc_count == g->count || alloc_guard_calls() != g->calls || n_joysticks != g->n_joysticks)
+        return;
+
+    log_infof("%" PRIu64 " allocations while handling input", alloc_count - g->count);
+    abort();
+}
+
+#define ALLOC_GUARD() cleanup(alloc_guard_check) const alloc_guard _alloc_guard = \
+    { alloc_count, alloc_guard_calls(), n_joysticks }
+#else
+#define ALLOC_GUARD()
+#endif
+
 static int
-dbus_call(sd_bus *bus, sd_bus_message **reply,
-    const char *dest, const char *path, const char *interface,
-    const char *member, const char *types, ...)
-{
-    cleanup(sd_bus_message_unrefp) sd_bus_message *m = NULL;
-    cleanup(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+parse_seconds(const char *v, uint64_t *usec) {
+    char *end;
+    errno = 0;
+    const unsigned long long n = strtoull(v, &end, 10);
+    if (errno || end == v || *end || n > UINT64_MAX / 1000000)
+        return -EINVAL;
+    *usec = n * 1000000;
+    return 0;
+}
+
+static int
+parse_bool(const char *v) {
+    if (!strcmp(v, "1") || !strcasecmp(v, "yes") || !strcasecmp(v, "true") || !strcasecmp(v, "on"))
+        return 1;
+    if (!strcmp(v, "0") || !strcasecmp(v, "no") || !strcasecmp(v, "false") || !strcasecmp(v, "off"))
+        return 0;
+    return -EINVAL;
+}
+
+static int
+parse_percent(const char *v, int *percent) {
+    char *end;
+    errno = 0;
+    const long n = strtol(v, &end, 10);
+    if (errno || end == v || *end || n < 0 || n > 100)
+        return -EINVAL;
+    *percent = n;
+    return 0;
+}
+
+static void
+config_free(config *c) {
+    for (size_t i = 0; i < c->n_ignore; ++i)
+        free(c->ignore[i]);
+    c->n_ignore = 0;
+}
+
+static int
+config_set(config *c, const char *key, const char *value) {
     int r;
 
-    r = sd_bus_message_new_method_call(bus, &m, dest, path, interface, member);
-    if (r < 0)
-        return log_error(r, "Failed to create bus message");
+    if (!strcmp(key, "timeout")) {
+        r = parse_seconds(value, &c->timeout);
+        if (r < 0 || !c->timeout)
+            return -EINVAL;
+    } else if (!strcmp(key, "accuracy")) {
+        r = parse_seconds(value, &c->accuracy);
+        if (r < 0)
+            return r;
+    } else if (!strcmp(key, "exit-idle")) {
+        r = parse_seconds(value, &c->exit_idle);
+        if (r < 0)
+            return r;
+    } else if (!strcmp(key, "poll")) {
+        r = parse_seconds(value, &c->poll);
+        if (r < 0)
+            return r;
+    } else if (!strcmp(key, "system")) {
+        r = parse_bool(value);
+        if (r < 0)
+            return r;
+        c->system = r;
+    } else if (!strcmp(key, "park")) {
+        r = parse_bool(value);
+        if (r < 0)
+            return r;
+        c->park = r;
+    } else if (!strcmp(key, "axes")) {
+        r = parse_bool(value);
+        if (r < 0)
+            return r;
+        c->axes = r;
+    } else if (!strcmp(key, "deadzone")) {
+        r = parse_percent(value, &c->deadzone);
+        if (r < 0)
+            return r;
+    } else if (!strcmp(key, "threshold")) {
+        r = parse_percent(value, &c->threshold);
+        if (r < 0)
+            return r;
+    } else if (!strcmp(key, "inhibitor")) {
+        c->inhibitor = 0;
+        for (size_t i = 0; i < N_INHIBITORS && !c->inhibitor; ++i)
+            if (!strcmp(value, g_inhibitors[i].name))
+                c->inhibitor = i + 1;
+        if (!c->inhibitor && strcmp(value, "auto"))
+            return -EINVAL;
+    } else if (!strcmp(key, "backend")) {
+        if (!strcmp(value, "epoll"))
+            c->uring = 0;
+        else if (!strcmp(value, "io_uring")) {
+#ifdef HAVE_LIBURING
+            c->uring = 1;
+#else
+            return -EOPNOTSUPP;
+#endif
+        } else
+            return -EINVAL;
+    } else if (!strcmp(key, "ignore")) {
+        if (c->n_ignore == MAX_IGNORE)
+            return -E2BIG;
+        if (!(c->ignore[c->n_ignore] = strdup(value)))
+            return -ENOMEM;
+        ++c->n_ignore;
+    } else
+        return -ENOENT;
 
-    va_list va;
-    va_start(va, types);
-    r = sd_bus_message_appendv(m, types, va);
-    va_end(va);
+    return 0;
+}
 
-    if (r < 0)
-        return log_error(r, "Failed to append to bus message");
+static char *
+strip(char *s) {
+    while (*s == ' ' || *s == '\t')
+        ++s;
+    char *e = s + strlen(s);
+    while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\n' || e[-1] == '\r'))
+        --e;
+    *e = 0;
+    return s;
+}
 
-    r = sd_bus_call(bus, m, -1, &error, reply);
-    if (r < 0)
-        return log_error(r, "Call failed");
+static int
+config_parse_file(config *c, const char *path) {
+    cleanup(fclosep) FILE *f = fopen(path, "re");
+    if (!f) {
+        if (errno == ENOENT && !g_config_required)
+            return 0;
+        return log_errorf(-errno, "Failed to open %s", path);
+    }
+
+    char line[1024];
+    for (unsigned n = 1; fgets(line, sizeof(line), f); ++n) {
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = 0;
+
+        char *key = strip(line);
+        if (!*key)
+            continue;
+
+        char *eq = strchr(key, '=');
+        if (!eq)
+            return log_errorf(-EINVAL, "%s:%u: expected key = value", path, n);
+        *eq = 0;
+
+        key = strip(key);
+        const char *value = strip(eq + 1);
+        int r = config_set(c, key, value);
+        if (r < 0)
+            return log_errorf(r, "%s:%u: bad %s = %s", path, n, key, value);
+    }
 
     return 0;
 }
 
+// defaults, then config file, then command line
 static int
-saver_inhibit(sd_bus *bus, const char *reason, uint32_t *cookie) {
-    cleanup(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+config_load(config *c) {
     int r;
 
-    r = dbus_call(bus, &reply, SAVER, SAVER_PATH, SAVER, "Inhibit",
-        "ss", PROJECT_NAME, reason);
-    if (r < 0)
-        return r;
+    *c = config_defaults;
+    if (g_config_path) {
+        r = config_parse_file(c, g_config_path);
+        if (r < 0)
+            return r;
+    }
 
-    r = sd_bus_message_read_basic(reply, 'u', cookie);
-    if (r < 0)
-        return log_error(r, "Failed to read Inhibit reply");
+    for (size_t i = 0; i < n_overrides; ++i) {
+        r = config_set(c, g_overrides[i][0], g_overrides[i][1]);
+        if (r < 0)
+            return log_errorf(r, "bad --%s %s", g_overrides[i][0], g_overrides[i][1]);
+    }
 
-    log_infof("screen saver inhibited; cookie=%u", *cookie);
     return 0;
 }
 
 static int
-saver_uninhibit(sd_bus *bus, uint32_t *cookie) {
-    cleanup(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
-    int r;
+config_ignored(const char *devname, const char *name) {
+    for (size_t i = 0; i < g_config.n_ignore; ++i)
+        if (!fnmatch(g_config.ignore[i], name, 0) || !fnmatch(g_config.ignore[i], devname, 0))
+            return 1;
+    return 0;
+}
+
+static uint64_t
+now_usec(void) {
+    if (g_replay)
+        return g_replay_now;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t
+loop_now(void) {
+    if (g_replay)
+        return g_replay_now;
+
+    uint64_t now = 0;
+    sd_event_now(sd_bus_get_event(g_bus), CLOCK_MONOTONIC, &now);
+    return now;
+}
+
+#define STATUS_LINE 1024
+
+typedef struct status_line {
+    char buf[STATUS_LINE];
+    size_t len;
+} status_line;
+
+static void
+status_printf(status_line *l, const char *fmt, ...) {
+    va_list va;
+    va_start(va, fmt);
+    const int n = vsnprintf(l->buf + l->len, sizeof(l->buf) - l->len, fmt, va);
+    va_end(va);
+    if (n > 0)
+        l->len = l->len + n < sizeof(l->buf) ? l->len + n : sizeof(l->buf);
+}
+
+// device names come from hardware, anything but quotes, backslashes and control characters goes as is
+static void
+status_string(status_line *l, const char *key, const char *value) {
+    if (!value) {
+        status_printf(l, ",\"%s\":null", key);
+        return;
+    }
+
+    status_printf(l, ",\"%s\":\"", key);
+    for (const unsigned char *c = (const unsigned char *)value; *c; ++c) {
+        if (*c == '"' || *c == '\\')
+            status_printf(l, "\\%c", *c);
+        else if (*c < 0x20)
+            status_printf(l, "\\u%04x", *c);
+        else
+            status_printf(l, "%c", *c);
+    }
+    status_printf(l, "\"");
+}
+
+// writes a line for a transition of seat s, or of joystick j on it.
+// called on device and inhibit changes and when the deadline timer is armed,
+// never for events: presses move the deadline silently until the timer fires.
+static void
+status_emit(const char *event, const seat *s, const joystick *j) {
+    if (g_status_fd < 0)
+        return;
+
+    status_line l = { .len = 0 };
+    status_printf(&l, "{\"event\":\"%s\"", event);
+    status_string(&l, "seat", s->name);
+    if (j) {
+        status_string(&l, "device", j->devname);
+        status_string(&l, "name", j->name);
+    }
+    status_string(&l, "inhibitor", s->inhibited_since ? s->inhibitor->name : NULL);
+
+    // unix time is what scripts can compare with, CLOCK_MONOTONIC they can't
+    uint64_t deadline = 0;
+    if (s->policy.want_inhibit) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        const uint64_t now = now_usec();
+        const uint64_t t = s->policy.last_press + s->policy.timeout;
+        deadline = ts.tv_sec + (t > now ? (t - now + 999999) / 1000000 : 0);
+    }
+    status_printf(&l, ",\"inhibited\":%s,\"deadline\":%" PRIu64 ",\"devices\":%zu}\n",
+        s->inhibited_since ? "true" : "false", deadline, n_joysticks);
+
+    // a line cut short is not JSON, drop it
+    if (l.len == sizeof(l.buf))
+        return;
+
+    // nobody reads: drop the line rather than wait
+    const ssize_t n = write(g_status_fd, l.buf, l.len);
+    if (n >= 0 || errno == EAGAIN)
+        return;
+
+    log_error(-errno, "Failed to write status, stopping");
+    close(g_status_fd);
+    g_status_fd = -1;
+}
 
-    if (!*cookie)
+// a fifo is opened for reading too: it stays open without readers and writes never get EPIPE.
+// lines written meanwhile wait in the pipe, until it is full.
+static int
+status_open(void) {
+    if (g_status_fifo) {
+        if (mkfifo(g_status_fifo, 0644) < 0 && errno != EEXIST)
+            return log_errorf(-errno, "Failed to create %s", g_status_fifo);
+
+        g_status_fd = open(g_status_fifo, O_RDWR|O_NONBLOCK|O_CLOEXEC);
+        if (g_status_fd < 0)
+            return log_errorf(-errno, "Failed to open %s", g_status_fifo);
+
+        struct stat st;
+        if (fstat(g_status_fd, &st) < 0 || !S_ISFIFO(st.st_mode)) {
+            close(g_status_fd);
+            g_status_fd = -1;
+            return log_errorf(-EINVAL, "%s is not a fifo", g_status_fifo);
+        }
         return 0;
+    }
 
-    r = dbus_call(bus, &reply, SAVER, SAVER_PATH, SAVER, "UnInhibit",
-        "u", *cookie);
-    if (r < 0)
-        return r;
+    if (g_status_fd < 0)
+        return 0;
 
-    log_infof("screen saver restored; cookie=%u", *cookie);
-    *cookie = 0;
+    // the event loop must never block on a slow reader
+    const int flags = fcntl(g_status_fd, F_GETFL);
+    if (flags < 0 || fcntl(g_status_fd, F_SETFL, flags | O_NONBLOCK) < 0
+        || fcntl(g_status_fd, F_SETFD, FD_CLOEXEC) < 0)
+        return log_errorf(-errno, "Failed to use status fd %d", g_status_fd);
 
+    // the reader going away is a write error, not a reason to die
+    signal(SIGPIPE, SIG_IGN);
     return 0;
 }
 
 static int
-saver_is_active(sd_bus *bus) {
-    cleanup(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+metrics_get_inhibited(unused sd_bus *bus, unused const char *path,
+    unused const char *interface, unused const char *property,
+    sd_bus_message *reply, void *userdata, unused sd_bus_error *ret_error)
+{
+    const metrics *m = userdata;
+    uint64_t v = m->inhibited_usec;
+    for (size_t n = 0; n < n_seats; ++n)
+        if (g_seats[n].inhibited_since)
+            v += loop_now() - g_seats[n].inhibited_since;
+    return sd_bus_message_append_basic(reply, 't', &v);
+}
+
+static int
+metrics_get_deadline(unused sd_bus *bus, unused const char *path,
+    unused const char *interface, unused const char *property,
+    sd_bus_message *reply, unused void *userdata, unused sd_bus_error *ret_error)
+{
+    uint64_t v = 0;
+    for (size_t n = 0; n < n_seats; ++n)
+        if (g_seats[n].policy.want_inhibit && g_seats[n].policy.last_press + g_config.timeout > v)
+            v = g_seats[n].policy.last_press + g_config.timeout;
+    return sd_bus_message_append_basic(reply, 't', &v);
+}
+
+static int
+metrics_get_devices(unused sd_bus *bus, unused const char *path,
+    unused const char *interface, unused const char *property,
+    sd_bus_message *reply, unused void *userdata, unused sd_bus_error *ret_error)
+{
     int r;
 
-    r = dbus_call(bus, &reply, DBUS, DBUS_PATH, DBUS, "NameHasOwner",
-        "s", SAVER);
+    r = sd_bus_message_open_container(reply, 'a', "(sstttttttt)");
     if (r < 0)
         return r;
 
-    int v;
-    r = sd_bus_message_read_basic(reply, 'b', &v);
-    if (r < 0)
-        return log_error(r, "Failed to read NameHasOwner reply");
+    for (size_t i = 0; i < n_joysticks; ++i) {
+        const joystick *j = &g_joysticks[i];
+        r = sd_bus_message_append(reply, "(sstttttttt)", j->devname, j->name,
+            j->input.n_events, j->input.n_presses, j->n_wakeups, j->input.n_reads, j->input.n_dropped,
+            (uint64_t)j->parked, j->input.chatter.n_ignored, j->input.chatter.until);
+        if (r < 0)
+            return r;
+    }
 
-    log_infof("screensaver is %s", v ? "active" : "not active");
-    return v;
+    return sd_bus_message_close_container(reply);
 }
 
 static int
-joystick_probe(sd_device *d, const char **devname, const char **name) {
+metrics_get_inhibitor(unused sd_bus *bus, unused const char *path,
+    unused const char *interface, unused const char *property,
+    sd_bus_message *reply, unused void *userdata, unused sd_bus_error *ret_error)
+{
+    for (size_t n = 0; n < n_seats; ++n)
+        if (g_seats[n].inhibitor)
+            return sd_bus_message_append_basic(reply, 's', g_seats[n].inhibitor->name);
+    return sd_bus_message_append_basic(reply, 's', "");
+}
+
+static int
+metrics_get_inhibitors(unused sd_bus *bus, unused const char *path,
+    unused const char *interface, unused const char *property,
+    sd_bus_message *reply, unused void *userdata, unused sd_bus_error *ret_error)
+{
     int r;
 
-    const char *v;
-    r = sd_device_get_property_value(d, "ID_INPUT_JOYSTICK", &v);
+    r = sd_bus_message_open_container(reply, 'a', "(sbttt)");
     if (r < 0)
         return r;
-    if (!v || strcmp(v, "1"))
-        return 0;
 
-    r = sd_device_get_devname(d, &v);
+    for (size_t n = 0; n < N_INHIBITORS; ++n) {
+        const inhibitor *i = &g_inhibitors[n];
+        int present = 0;
+        for (size_t k = 0; k < n_seats; ++k)
+            present |= !!(g_seats[k].present & 1U << n);
+        r = sd_bus_message_append(reply, "(sbttt)", i->name, present,
+            i->n_calls, i->call_usec, i->call_max);
+        if (r < 0)
+            return r;
+    }
+
+    return sd_bus_message_close_container(reply);
+}
+
+static const sd_bus_vtable metrics_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_PROPERTY("InhibitCalls", "t", NULL, offsetof(metrics, n_inhibit),
+        SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("UnInhibitCalls", "t", NULL, offsetof(metrics, n_uninhibit),
+        SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("InhibitedUSec", "t", metrics_get_inhibited, 0,
+        SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    // CLOCK_MONOTONIC, 0 if there is nothing to inhibit, the latest of all seats
+    SD_BUS_PROPERTY("DeadlineUSec", "t", metrics_get_deadline, 0,
+        SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    // devname, name, events, presses, wakeups, reads, dropped, parked,
+    // presses ignored as noisy, CLOCK_MONOTONIC end of quarantine or 0
+    SD_BUS_PROPERTY("Devices", "a(sstttttttt)", metrics_get_devices, 0,
+        SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    // the one holding the inhibition, empty if none. the first one in system mode
+    SD_BUS_PROPERTY("Inhibitor", "s", metrics_get_inhibitor, 0,
+        SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    // name, present on any seat, round trips, their total and max usec
+    SD_BUS_PROPERTY("Inhibitors", "a(sbttt)", metrics_get_inhibitors, 0,
+        SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("WakeCalls", "t", NULL, offsetof(metrics, n_wake),
+        SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    // press-to-wake of the last wake
+    SD_BUS_PROPERTY("WakeLatencyUSec", "t", NULL, offsetof(metrics, wake_usec),
+        SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_VTABLE_END
+};
+
+// counters are plain increments on the hot path. they don't trigger signals on their own,
+// but are picked up by the next one: every state change (device, inhibit, deadline)
+// schedules PropertiesChanged with all properties, at most once per metrics_interval.
+static void
+metrics_changed(void) {
+    int r;
+
+    int enabled = 0;
+    if (!g_metrics_timer || (sd_event_source_get_enabled(g_metrics_timer, &enabled) >= 0 && enabled))
+        return;
+
+    r = sd_event_source_set_time_relative(g_metrics_timer, metrics_interval);
+    if (r < 0) {
+        log_error(r, "Failed to reset the metrics timer");
+        return;
+    }
+
+    r = sd_event_source_set_enabled(g_metrics_timer, SD_EVENT_ONESHOT);
     if (r < 0)
-        return r;
+        log_error(r, "Failed to enable the metrics timer");
+}
 
-    static const char event_pfx[] = "/dev/input/event";
-    if (!v || strncmp(v, event_pfx, sizeof(event_pfx)-1))
-        return 0;
+static int
+on_metrics_timer(unused sd_event_source *s, unused uint64_t usec, void *userdata) {
+    sd_bus *bus = userdata;
+    int r;
 
-    sd_device *parent;
-    r = sd_device_get_parent(d, &parent);
+    r = sd_bus_emit_properties_changed(bus, METRICS_PATH, METRICS,
+        "InhibitCalls", "UnInhibitCalls", "InhibitedUSec", "DeadlineUSec", "Devices",
+        "Inhibitor", "Inhibitors", "WakeCalls", "WakeLatencyUSec", NULL);
     if (r < 0)
-        return r;
+        log_error(r, "Failed to emit metrics");
 
-    *devname = v;
-    r = sd_device_get_property_value(parent, "NAME", name);
-    if (r < 0 || !name || !name[0])
-        *name = v;
+    return 0;
+}
 
-    return 1;
+// the default handler drops the connection when the name is denied,
+// and in system mode that is the bus logind lives on
+static int
+on_metrics_name_reply(sd_bus_message *m, unused void *userdata, unused sd_bus_error *ret_error) {
+    const sd_bus_error *e = sd_bus_message_get_error(m);
+    if (e)
+        log_infof("metrics are not available as %s: %s", METRICS, e->message);
+    return 0;
+}
+
+static int
+metrics_init(sd_bus *bus) {
+    int r;
+
+    r = sd_event_add_time_relative(sd_bus_get_event(bus), &g_metrics_timer, CLOCK_MONOTONIC,
+        metrics_interval, 0, on_metrics_timer, bus);
+    if (r < 0)
+        return log_error(r, "Failed to initialize metrics timer");
+
+    r = sd_event_source_set_enabled(g_metrics_timer, SD_EVENT_OFF);
+    assert(r >= 0);
+
+    r = sd_bus_add_object_vtable(bus, NULL, METRICS_PATH, METRICS, metrics_vtable, &g_metrics);
+    if (r < 0)
+        return log_error(r, "Failed to export metrics");
+
+    r = sd_bus_request_name_async(bus, NULL, METRICS, 0, on_metrics_name_reply, NULL);
+    if (r < 0)
+        return log_error(r, "Failed to request metrics bus name");
+
+    return 0;
 }
 
 static void
-joystick_destroy(void *userdata) {
-    joystick *j = userdata;
+latency_record(uint64_t *histogram, uint64_t usec) {
+    size_t i = usec ? 64 - __builtin_clzll(usec) : 0;
+    if (i >= LATENCY_BUCKETS)
+        i = LATENCY_BUCKETS - 1;
+    ++histogram[i];
+}
 
-    sd_device_unref(j->dev);
-    assert((signed)n_joysticks > 0);
-    --n_joysticks;
-    const size_t n = j - g_joysticks;
-    if (n < n_joysticks) {
-        // we just freed slot in the middle. swap previous last joystick with one.
-        *j = g_joysticks[n_joysticks];
-        sd_event_source_set_userdata(j->source, j);
+static void
+latency_print(const char *what, const uint64_t *histogram) {
+    size_t first = LATENCY_BUCKETS, last = 0;
+    uint64_t total = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+        if (!histogram[i])
+            continue;
+        if (first == LATENCY_BUCKETS)
+            first = i;
+        last = i;
+        total += histogram[i];
     }
+
+    log_infof("%s latency: %" PRIu64 " samples", what, total);
+    for (size_t i = first; i <= last && total; ++i)
+        log_infof("  < %10" PRIu64 "us: %" PRIu64, (uint64_t)1 << i, histogram[i]);
 }
 
 static void
-joystick_del(joystick *j) {
-    log_infof("-%zd/%zd: %s %s events=%" PRId64,
-        j - g_joysticks, n_joysticks, j->devname, j->name, j->n_events);
-    sd_event_source_disable_unref(j->source);
+latency_dump(void) {
+    latency_print("press-to-inhibit", g_latency);
+    if (g_metrics.n_wake)
+        latency_print("press-to-wake", g_wake_latency);
+
+    for (size_t n = 0; n < N_INHIBITORS; ++n) {
+        const inhibitor *i = &g_inhibitors[n];
+        if (i->n_calls)
+            log_infof("%s round trip: %" PRIu64 " calls, avg %" PRIu64 "us, max %" PRIu64 "us",
+                i->name, i->n_calls, i->call_usec / i->n_calls, i->call_max);
+    }
 }
 
 static int
-is_button_press(const struct input_event *event) {
-    return event->type == EV_KEY && event->value == 0;
+on_latency_dump(unused sd_event_source *s, unused const struct signalfd_siginfo *si,
+    unused void *userdata)
+{
+    latency_dump();
+    return 0;
 }
 
 static int
-on_joystick_read(unused sd_event_source *s, int fd,
-    unused uint32_t revents, unused void *userdata)
+latency_exit(unused sd_event_source *s, unused void *userdata) {
+    latency_dump();
+    return 0;
+}
+
+static int
+dbus_call_async(sd_bus *bus, sd_bus_slot **slot, sd_bus_message_handler_t callback,
+    void *userdata, const char *dest, const char *path, const char *interface,
+    const char *member, const char *types, ...)
 {
+    cleanup(sd_bus_message_unrefp) sd_bus_message *m = NULL;
     int r;
-    joystick *j = userdata;
 
-    struct input_event event[1];
-    r = read(fd, event, sizeof(event));
-    if (r != sizeof(event)) {
-        r = -errno;
-        if (r == -ENODEV) {
-                joystick_del(j);
-                return 0;
-        } else
-                return log_errorf(r, "%s %s read failed", j->name, j->devname);
+    r = sd_bus_message_new_method_call(bus, &m, dest, path, interface, member);
+    if (r < 0)
+        return log_error(r, "Failed to create bus message");
+
+    va_list va;
+    va_start(va, types);
+    r = sd_bus_message_appendv(m, types, va);
+    va_end(va);
+
+    if (r < 0)
+        return log_error(r, "Failed to append to bus message");
+
+    r = sd_bus_call_async(bus, slot, m, callback, userdata, call_timeout);
+    if (r < 0)
+        return log_errorf(r, "%s call failed", member);
+
+    return 0;
+}
+
+static int
+log_reply_error(sd_bus_message *m, const char *member) {
+    const sd_bus_error *e = sd_bus_message_get_error(m);
+    return log_errorf(-sd_bus_message_get_errno(m), "%s failed: %s",
+        member, e->message ? e->message : e->name);
+}
+
+static void saver_sync(seat *s, const char *reason);
+static void saver_inhibited(seat *s, int r);
+static void saver_released(seat *s, int r);
+static void metrics_uninhibited(seat *s);
+
+// org.freedesktop.ScreenSaver and org.gnome.SessionManager hand out a cookie
+static int
+on_cookie_reply(sd_bus_message *m, void *userdata, unused sd_bus_error *ret_error) {
+    seat *s = userdata;
+    int r = 0;
+
+    s->call = sd_bus_slot_unref(s->call);
+    if (sd_bus_message_is_method_error(m, NULL))
+        r = log_reply_error(m, "Inhibit");
+    else if ((r = sd_bus_message_read_basic(m, 'u', &s->cookie)) < 0)
+        log_error(r, "Failed to read Inhibit reply");
+    else
+        log_infof("%s cookie=%u", s->inhibitor->name, s->cookie);
+
+    saver_inhibited(s, r);
+    return 0;
+}
+
+static int
+on_release_reply(sd_bus_message *m, void *userdata, unused sd_bus_error *ret_error) {
+    seat *s = userdata;
+    int r = 0;
+
+    s->call = sd_bus_slot_unref(s->call);
+    if (sd_bus_message_is_method_error(m, NULL))
+        r = log_reply_error(m, "UnInhibit");
+
+    saver_released(s, r);
+    return 0;
+}
+
+static int
+screensaver_inhibit(seat *s, const char *reason) {
+    return dbus_call_async(s->bus, &s->call, on_cookie_reply, s, SAVER, SAVER_PATH, SAVER,
+        "Inhibit", "ss", PROJECT_NAME, reason);
+}
+
+static int
+screensaver_uninhibit(seat *s) {
+    return dbus_call_async(s->bus, &s->call, on_release_reply, s, SAVER, SAVER_PATH, SAVER,
+        "UnInhibit", "u", s->cookie);
+}
+
+static int
+gnome_inhibit(seat *s, const char *reason) {
+    return dbus_call_async(s->bus, &s->call, on_cookie_reply, s, GNOME_SM, GNOME_SM_PATH, GNOME_SM,
+        "Inhibit", "susu", PROJECT_NAME, 0, reason, GNOME_SM_IDLE);
+}
+
+static int
+gnome_uninhibit(seat *s) {
+    return dbus_call_async(s->bus, &s->call, on_release_reply, s, GNOME_SM, GNOME_SM_PATH, GNOME_SM,
+        "Uninhibit", "u", s->cookie);
+}
+
+// logind hands out a pipe fd, the lock is held until it is closed
+static int
+on_logind_reply(sd_bus_message *m, void *userdata, unused sd_bus_error *ret_error) {
+    seat *s = userdata;
+    int fd, r = 0;
+
+    s->call = sd_bus_slot_unref(s->call);
+    if (sd_bus_message_is_method_error(m, NULL))
+        r = log_reply_error(m, "Inhibit");
+    else if ((r = sd_bus_message_read_basic(m, 'h', &fd)) < 0)
+        log_error(r, "Failed to read Inhibit reply");
+    else if ((s->fd = fcntl(fd, F_DUPFD_CLOEXEC, 3)) < 0)
+        r = log_error(-errno, "Failed to keep inhibitor fd");
+
+    saver_inhibited(s, r);
+    return 0;
+}
+
+static int
+logind_inhibit(seat *s, const char *reason) {
+    return dbus_call_async(g_system_bus, &s->call, on_logind_reply, s, LOGIN, LOGIN_PATH,
+        LOGIN_MANAGER, "Inhibit", "ssss", "idle", PROJECT_NAME, reason, "block");
+}
+
+static int
+logind_uninhibit(seat *s) {
+    assert(s->fd >= 0);
+    close(s->fd);
+    s->fd = -1;
+    return 1;
+}
+
+#ifdef HAVE_X11
+static Display *g_display;
+static sd_event_source *g_x11_heartbeat;
+static const uint64_t x11_heartbeat = 30000000; // 30s
+
+// XScreenSaverSuspend() stops X server's own saver and DPMS, but desktop idle
+// monitors look at the time of the last input. XResetScreenSaver() restarts it,
+// so it is repeated while inhibited. both are one-way requests without a reply.
+static int
+x11_inhibit(unused seat *s, unused const char *reason) {
+    int r;
+
+    XScreenSaverSuspend(g_display, True);
+    XResetScreenSaver(g_display);
+    XFlush(g_display);
+
+    r = sd_event_source_set_time_relative(g_x11_heartbeat, x11_heartbeat);
+    if (r < 0)
+        return log_error(r, "Failed to reset X11 heartbeat");
+
+    r = sd_event_source_set_enabled(g_x11_heartbeat, SD_EVENT_ON);
+    if (r < 0)
+        return log_error(r, "Failed to enable X11 heartbeat");
+
+    return 1;
+}
+
+static int
+x11_uninhibit(unused seat *s) {
+    sd_event_source_set_enabled(g_x11_heartbeat, SD_EVENT_OFF);
+    XScreenSaverSuspend(g_display, False);
+    XFlush(g_display);
+    return 1;
+}
+#endif
+
+static inhibitor g_inhibitors[N_INHIBITORS] = {
+    { .name = "screensaver", .service = SAVER,
+      .inhibit = screensaver_inhibit, .uninhibit = screensaver_uninhibit },
+    { .name = "gnome", .service = GNOME_SM,
+      .inhibit = gnome_inhibit, .uninhibit = gnome_uninhibit },
+#ifdef HAVE_X11
+    // it costs a wakeup every x11_heartbeat while inhibited
+    { .name = "x11", .oneway = 1,
+      .inhibit = x11_inhibit, .uninhibit = x11_uninhibit },
+#endif
+    // last: it is on every systemd machine, but desktops blanking the screen
+    // themselves don't look at idle inhibitors
+    { .name = "logind", .service = LOGIN, .system = 1, .oneway = 1,
+      .inhibit = logind_inhibit, .uninhibit = logind_uninhibit },
+};
+
+// replay has nothing to talk to, it inhibits with the stub below only
+static int
+replay_inhibit(unused seat *s, const char *reason) {
+    log_infof("%" PRIu64 ".%06" PRIu64 " inhibit: %s",
+        g_replay_now / 1000000, g_replay_now % 1000000, reason);
+    return 1;
+}
+
+static int
+replay_uninhibit(unused seat *s) {
+    log_infof("%" PRIu64 ".%06" PRIu64 " uninhibit",
+        g_replay_now / 1000000, g_replay_now % 1000000);
+    return 1;
+}
+
+static inhibitor g_replay_inhibitor = {
+    .name = "replay", .oneway = 1,
+    .inhibit = replay_inhibit, .uninhibit = replay_uninhibit,
+};
+
+static int
+inhibitor_usable(const seat *s, const inhibitor *i) {
+    if (g_replay)
+        return i == &g_replay_inhibitor;
+
+    const size_t n = i - g_inhibitors;
+    return (s->present & 1U << n) && (!g_config.inhibitor || (size_t)g_config.inhibitor == n + 1);
+}
+
+static inhibitor *
+inhibitor_pick(const seat *s) {
+    if (g_replay)
+        return &g_replay_inhibitor;
+    for (size_t n = 0; n < N_INHIBITORS; ++n)
+        if (inhibitor_usable(s, &g_inhibitors[n]))
+            return &g_inhibitors[n];
+    return NULL;
+}
+
+static void
+inhibitor_account(const seat *s, uint64_t now) {
+    inhibitor *i = s->inhibitor;
+    const uint64_t usec = now > s->call_start ? now - s->call_start : 0;
+    ++i->n_calls;
+    i->call_usec += usec;
+    if (usec > i->call_max)
+        i->call_max = usec;
+}
+
+// carries out POLICY_ARM
+static int
+seat_arm(seat *s) {
+    int r;
+
+    r = sd_event_source_set_time(s->timer, s->policy.timer);
+    if (r >= 0)
+        r = sd_event_source_set_enabled(s->timer, SD_EVENT_ONESHOT);
+    if (r < 0) {
+        // the next press tries again
+        s->policy.armed = 0;
+        return log_error(r, "Failed to arm the timer");
+    }
+
+    status_emit("deadline", s, NULL);
+    return 0;
+}
+
+static void
+saver_retry(seat *s) {
+    int r;
+
+    r = sd_event_source_set_time_relative(s->retry, s->policy.retry_delay);
+    if (r < 0) {
+        log_error(r, "Failed to reset the retry timer");
+        policy_retry(&s->policy);
+        return;
+    }
+
+    r = sd_event_source_set_enabled(s->retry, SD_EVENT_ONESHOT);
+    if (r < 0) {
+        log_error(r, "Failed to enable the retry timer");
+        policy_retry(&s->policy);
+        return;
+    }
+
+    log_infof("retry in %" PRIu64 "ms", s->policy.retry_delay / 1000);
+}
+
+static int
+on_retry(unused sd_event_source *source, unused uint64_t usec, void *userdata) {
+    seat *s = userdata;
+    policy_retry(&s->policy);
+    saver_sync(s, NULL);
+    return 0;
+}
+
+static void
+saver_inhibited(seat *s, int r) {
+    const uint64_t now = now_usec();
+    inhibitor_account(s, now);
+    PROBE(inhibit__done, s->inhibitor->name, r, now - s->call_start);
+
+    if (policy_inhibited(&s->policy, r >= 0) & POLICY_RETRY) {
+        s->inhibitor = NULL;
+        saver_retry(s);
+        return;
+    }
+
+    if (s->latency_press) {
+        latency_record(g_latency, now > s->latency_press ? now - s->latency_press : 0);
+        s->latency_press = 0;
+    }
+
+    log_infof("screen saver inhibited with %s%s%s", s->inhibitor->name,
+        s->name ? " on " : "", s->name ? s->name : "");
+    s->inhibited_since = loop_now();
+    status_emit("inhibit", s, NULL);
+    metrics_changed();
+
+    // deadline might have passed while the call was in flight
+    saver_sync(s, NULL);
+}
+
+static void
+saver_inhibit(seat *s, inhibitor *i, const char *reason) {
+    int r;
+
+    s->inhibitor = i;
+    s->call_start = now_usec();
+    PROBE(inhibit__start, i->name, s->name);
+    r = i->inhibit(s, reason ? reason : "joystick activity");
+    if (r < 0) {
+        s->inhibitor = NULL;
+        policy_failed(&s->policy);
+        saver_retry(s);
+        return;
+    }
+
+    ++g_metrics.n_inhibit;
+    if (r > 0)
+        saver_inhibited(s, 0);
+}
+
+static void
+saver_released(seat *s, int r) {
+    const uint64_t now = now_usec();
+    inhibitor_account(s, now);
+    PROBE(uninhibit__done, s->inhibitor->name, r, now - s->call_start);
+
+    if (policy_released(&s->policy, r >= 0) & POLICY_RETRY) {
+        saver_retry(s);
+        return;
+    }
+
+    log_infof("screen saver restored by %s%s%s", s->inhibitor->name,
+        s->name ? " on " : "", s->name ? s->name : "");
+    s->cookie = 0;
+    s->inhibitor = NULL;
+    metrics_uninhibited(s);
+
+    // buttons might have been pressed while the call was in flight
+    saver_sync(s, NULL);
+}
+
+static void
+saver_uninhibit(seat *s) {
+    int r;
+
+    s->call_start = now_usec();
+    PROBE(uninhibit__start, s->inhibitor->name, s->name);
+    r = s->inhibitor->uninhibit(s);
+    if (r < 0) {
+        policy_failed(&s->policy);
+        saver_retry(s);
+        return;
+    }
+
+    ++g_metrics.n_uninhibit;
+    if (r > 0)
+        saver_released(s, 0);
+}
+
+// repeated presses while waiting for the screen to come back don't call again
+static const uint64_t wake_interval = 1000000; // 1s
+
+// screen saver is active: bring the screen back right away, not just keep it from blanking.
+// called before anything else on the press, with no reply expected: sd-bus writes it
+// out right here if nothing is queued before it, and there is no reply to dispatch.
+// ActiveChanged(false) tells when the screen is back.
+static void
+saver_wake(seat *s, uint64_t pressed) {
+    int r;
+
+    if (!s->bus || (s->wake_press && pressed < s->wake_press + wake_interval))
+        return;
+
+    cleanup(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+    r = sd_bus_message_new_method_call(s->bus, &m, SAVER, SAVER_PATH, SAVER, "SimulateUserActivity");
+    if (r >= 0)
+        r = sd_bus_message_set_expect_reply(m, 0);
+    if (r >= 0)
+        r = sd_bus_send(s->bus, m, NULL);
+    if (r < 0) {
+        log_error(r, "Failed to wake screen saver");
+        return;
+    }
+
+    PROBE(wake, s->name, pressed);
+    s->wake_press = pressed;
+    ++g_metrics.n_wake;
+    metrics_changed();
+}
+
+// with on-demand activation there is nothing to stay around for
+// once all joysticks are gone and screen saver is not inhibited
+static int
+is_idle(void) {
+    if (n_joysticks)
+        return 0;
+    for (size_t n = 0; n < n_seats; ++n)
+        if (!policy_idle(&g_seats[n].policy))
+            return 0;
+    return 1;
+}
+
+static void
+idle_check(void) {
+    int r;
+
+    if (!g_idle)
+        return;
+
+    if (!g_config.exit_idle || !is_idle()) {
+        r = sd_event_source_set_enabled(g_idle, SD_EVENT_OFF);
+        assert(r >= 0);
+        return;
+    }
+
+    int enabled = 0;
+    if (sd_event_source_get_enabled(g_idle, &enabled) >= 0 && enabled)
+        return;
+
+    r = sd_event_source_set_time_relative(g_idle, g_config.exit_idle);
+    if (r < 0) {
+        log_error(r, "Failed to reset the idle timer");
+        return;
+    }
+
+    r = sd_event_source_set_enabled(g_idle, SD_EVENT_ONESHOT);
+    if (r < 0)
+        log_error(r, "Failed to enable the idle timer");
+}
+
+static void
+saver_sync(seat *s, const char *reason) {
+    policy *p = &s->policy;
+
+    // without an inhibitor a press is only remembered:
+    // inhibitor_appeared() gets back here if it is still wanted by then.
+    // config might have switched to another inhibitor, or a preferred one might have
+    // appeared after the first press, say ScreenSaver after logind: it takes over after release.
+    inhibitor *i = p->state == SAVER_IDLE ? inhibitor_pick(s) : NULL;
+    const int usable = p->state == SAVER_INHIBITED && inhibitor_pick(s) == s->inhibitor;
+    const unsigned a = policy_sync(p, !!i, usable);
+    if (a & POLICY_INHIBIT)
+        saver_inhibit(s, i, reason);
+    else if (a & POLICY_RELEASE)
+        saver_uninhibit(s);
+
+    idle_check();
+}
+
+static void
+metrics_uninhibited(seat *s) {
+    if (s->inhibited_since) {
+        g_metrics.inhibited_usec += loop_now() - s->inhibited_since;
+        s->inhibited_since = 0;
+        status_emit("release", s, NULL);
+    }
+    metrics_changed();
+}
+
+// drops whatever the seat holds or is about to hold without waiting for replies.
+// cookies are only good while their service lives, so they are just forgotten.
+static void
+saver_forget(seat *s) {
+    inhibitor *i = s->inhibitor;
+    if (!i)
+        return;
+
+    if (s->policy.state == SAVER_INHIBITED && i->oneway)
+        i->uninhibit(s);
+    else if (s->cookie)
+        log_infof("stale %s cookie %u", i->name, s->cookie);
+
+    s->cookie = 0;
+    s->call = sd_bus_slot_unref(s->call);
+    s->inhibitor = NULL;
+    policy_forget(&s->policy);
+    metrics_uninhibited(s);
+}
+
+static void
+saver_reset(seat *s) {
+    saver_forget(s);
+    s->latency_press = 0;
+    policy_reset(&s->policy);
+
+    int r;
+    r = sd_event_source_set_enabled(s->timer, SD_EVENT_OFF);
+    assert(r >= 0);
+    r = sd_event_source_set_enabled(s->retry, SD_EVENT_OFF);
+    assert(r >= 0);
+
+    idle_check();
+}
+
+static size_t
+index_home(dev_t devnum) {
+    return ((uint64_t)devnum * 0x9e3779b97f4a7c15ULL >> 32) & (g_index_size - 1);
+}
+
+// returns slot of devnum in g_index or SIZE_MAX
+static size_t
+index_lookup(dev_t devnum) {
+    if (!g_index_size)
+        return SIZE_MAX;
+
+    const size_t mask = g_index_size - 1;
+    for (size_t s = index_home(devnum); g_index[s]; s = (s + 1) & mask)
+        if (g_joysticks[g_index[s] - 1].devnum == devnum)
+            return s;
+
+    return SIZE_MAX;
+}
+
+static void
+index_insert(size_t n) {
+    const size_t mask = g_index_size - 1;
+    size_t s = index_home(g_joysticks[n].devnum);
+    while (g_index[s])
+        s = (s + 1) & mask;
+    g_index[s] = n + 1;
+}
+
+static void
+index_remove(dev_t devnum) {
+    const size_t mask = g_index_size - 1;
+    size_t hole = index_lookup(devnum);
+    assert(hole != SIZE_MAX);
+
+    // shift following entries back, unless they would move before their home slot
+    g_index[hole] = 0;
+    for (size_t s = (hole + 1) & mask; g_index[s]; s = (s + 1) & mask) {
+        const size_t home = index_home(g_joysticks[g_index[s] - 1].devnum);
+        if (((s - home) & mask) >= ((s - hole) & mask)) {
+            g_index[hole] = g_index[s];
+            g_index[s] = 0;
+            hole = s;
+        }
+    }
+}
+
+static joystick *
+joystick_find(dev_t devnum) {
+    const size_t s = index_lookup(devnum);
+    return s == SIZE_MAX ? NULL : &g_joysticks[g_index[s] - 1];
+}
+
+// make room for one more joystick
+static int
+joystick_reserve(void) {
+    if (n_joysticks == g_joysticks_size) {
+        const size_t size = g_joysticks_size ? g_joysticks_size * 2 : 8;
+        joystick *joysticks = realloc(g_joysticks, size * sizeof(*joysticks));
+        if (!joysticks)
+            return -ENOMEM;
+
+        g_joysticks = joysticks;
+        g_joysticks_size = size;
+        for (size_t i = 0; i < n_joysticks; ++i)
+            sd_event_source_set_userdata(g_joysticks[i].source, &g_joysticks[i]);
+    }
+
+    if (g_index_size < 2 * g_joysticks_size) {
+        uint32_t *index = calloc(2 * g_joysticks_size, sizeof(*index));
+        if (!index)
+            return -ENOMEM;
+
+        free(g_index);
+        g_index = index;
+        g_index_size = 2 * g_joysticks_size;
+        for (size_t i = 0; i < n_joysticks; ++i)
+            index_insert(i);
+    }
+
+    return 0;
+}
+
+static void
+joystick_free_all(void) {
+    assert(!n_joysticks);
+    free(g_joysticks);
+    g_joysticks = NULL;
+    g_joysticks_size = 0;
+    free(g_index);
+    g_index = NULL;
+    g_index_size = 0;
+}
+
+static int
+joystick_probe(sd_device *d, const char **devname, const char **name) {
+    int r;
+
+    const char *v;
+    r = sd_device_get_property_value(d, "ID_INPUT_JOYSTICK", &v);
+    if (r < 0)
+        return r;
+    if (!v || strcmp(v, "1"))
+        return 0;
+
+    r = sd_device_get_devname(d, &v);
+    if (r < 0)
+        return r;
+
+    static const char event_pfx[] = "/dev/input/event";
+    if (!v || strncmp(v, event_pfx, sizeof(event_pfx)-1))
+        return 0;
+
+    sd_device *parent;
+    r = sd_device_get_parent(d, &parent);
+    if (r < 0)
+        return r;
+
+    *devname = v;
+    r = sd_device_get_property_value(parent, "NAME", name);
+    if (r < 0 || !name || !name[0])
+        *name = v;
+
+    if (config_ignored(*devname, *name))
+        return 0;
+
+    return 1;
+}
+
+#ifdef HAVE_LIBURING
+// io_uring backend: every joystick has a multishot read in flight, which takes
+// buffers from one shared provided-buffer ring. completions of all joysticks are
+// signalled through a single eventfd and processed in one batch, so there are
+// neither per-device readiness notifications nor read() calls.
+// the io sources are kept disabled, only to own fds and track joystick lifetime.
+#define URING_ENTRIES  64
+#define URING_BUFS     256  // power of 2
+#define URING_BUF_SIZE (READ_BATCH * sizeof(struct input_event))
+#define URING_BGID     0
+
+static struct io_uring g_ring;
+static struct io_uring_buf_ring *g_buf_ring;
+static uint8_t *g_bufs;
+static sd_event_source *g_uring_source;
+
+// completions are looked up by devnum, since joysticks move in g_joysticks
+static int
+uring_queue(joystick *j, int arm) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&g_ring);
+    if (!sqe) {
+        io_uring_submit(&g_ring);
+        sqe = io_uring_get_sqe(&g_ring);
+        if (!sqe)
+            return -EBUSY;
+    }
+
+    if (arm) {
+        io_uring_prep_read_multishot(sqe, sd_event_source_get_io_fd(j->source), 0, 0, URING_BGID);
+        io_uring_sqe_set_data64(sqe, j->devnum);
+    } else {
+        io_uring_prep_cancel64(sqe, j->devnum, 0);
+        io_uring_sqe_set_data64(sqe, 0);
+    }
+    return 0;
+}
+#endif
+
+// start or stop delivering events of the joystick
+static int
+joystick_poll(joystick *j, int on) {
+#ifdef HAVE_LIBURING
+    if (g_uring_source) {
+        int r = uring_queue(j, on);
+        if (r < 0)
+            return r;
+        r = io_uring_submit(&g_ring);
+        return r < 0 ? r : 0;
+    }
+#endif
+    return sd_event_source_set_enabled(j->source, on ? SD_EVENT_ON : SD_EVENT_OFF);
+}
+
+static void
+joystick_destroy(void *userdata) {
+    joystick *j = userdata;
+
+    free(j->input.axes);
+    assert((signed)n_joysticks > 0);
+    index_remove(j->devnum);
+    --n_joysticks;
+    // devname and name belong to the device, it goes after the line
+    status_emit("remove", j->seat, j);
+    sd_device_unref(j->dev);
+    const size_t n = j - g_joysticks;
+    if (n < n_joysticks) {
+        // we just freed slot in the middle. swap previous last joystick with one.
+        const size_t s = index_lookup(g_joysticks[n_joysticks].devnum);
+        assert(s != SIZE_MAX);
+        *j = g_joysticks[n_joysticks];
+        g_index[s] = n + 1;
+        sd_event_source_set_userdata(j->source, j);
+    }
+    metrics_changed();
+    idle_check();
+}
+
+static void
+joystick_del(joystick *j) {
+    PROBE(del, j->devname, j->name, j->input.n_events);
+    log_infof("-%zd/%zd: %s %s events=%" PRIu64 " wakeups=%" PRIu64
+        " reads=%" PRIu64 " batch=%.1f dropped=%" PRIu64 " missed=%" PRIu64 " ignored=%" PRIu64,
+        j - g_joysticks, n_joysticks, j->devname, j->name, j->input.n_events, j->n_wakeups,
+        j->input.n_reads, j->input.n_reads ? (double)j->input.n_events / j->input.n_reads : 0.0,
+        j->input.n_dropped, j->input.n_missed, j->input.chatter.n_ignored);
+#ifdef HAVE_LIBURING
+    // io_uring keeps its own reference to the file, so closing fd doesn't stop the read
+    if (g_uring_source && !j->parked && !j->polled)
+        joystick_poll(j, 0);
+#endif
+    sd_event_source_disable_unref(j->source);
+}
+
+// --record log: a file header, then records of a header and payload each.
+// events are stored as read, so a log only replays where struct input_event is the same.
+#define RECORD_MAGIC "JOYREC1"
+
+typedef struct record_file {
+    char magic[8];
+    uint32_t event_size;        // sizeof(struct input_event) of the writer
+    uint32_t reserved;
+} record_file;
+
+enum {
+    RECORD_DEVICE,              // record_device, then input_absinfo of every tracked axis
+    RECORD_EVENTS,              // a batch of input_event, as read
+    RECORD_KEYS,                // EVIOCGKEY bitmap taken after an overflow in the last batch
+};
+
+typedef struct record {
+    uint64_t devnum;
+    uint32_t type;
+    uint32_t size;              // of payload
+} record;
+
+#define RECORD_NAME 64
+
+typedef struct record_device {
+    char name[RECORD_NAME];     // not terminated if it fills the whole array
+    uint64_t tracked;
+    uint32_t masked;
+    uint32_t monotonic;
+} record_device;
+
+static void
+record_write(const struct iovec *iov, int n) {
+    ssize_t size = 0;
+    for (int i = 0; i < n; ++i)
+        size += iov[i].iov_len;
+
+    // a torn record would break the rest of the log, stop at the first failure
+    const ssize_t r = writev(g_record_fd, iov, n);
+    if (r == size)
+        return;
+
+    log_errorf(r < 0 ? -errno : -EIO, "Failed to write %s, stopped recording", g_record_path);
+    close(g_record_fd);
+    g_record_fd = -1;
+}
+
+static void
+record_events(const joystick *j, const struct input_event *events, size_t count) {
+    record h = { .devnum = j->devnum, .type = RECORD_EVENTS, .size = count * sizeof(*events) };
+    const struct iovec iov[] = {
+        { &h, sizeof(h) },
+        { (void *)events, h.size },
+    };
+    record_write(iov, 2);
+}
+
+static void
+record_keys(const joystick *j, const unsigned long *keys, size_t size) {
+    record h = { .devnum = j->devnum, .type = RECORD_KEYS, .size = size };
+    const struct iovec iov[] = {
+        { &h, sizeof(h) },
+        { (void *)keys, size },
+    };
+    record_write(iov, 2);
+}
+
+// info holds ranges of the tracked axes, in order of codes
+static void
+record_device_add(const joystick *j, const struct input_absinfo *info) {
+    record_device d = {
+        .tracked = j->input.axes ? j->input.axes->tracked : 0,
+        .masked = j->input.masked,
+        .monotonic = j->monotonic,
+    };
+    snprintf(d.name, sizeof(d.name), "%s", j->name);
+
+    const size_t n_axes = __builtin_popcountll(d.tracked);
+    record h = {
+        .devnum = j->devnum,
+        .type = RECORD_DEVICE,
+        .size = sizeof(d) + n_axes * sizeof(*info),
+    };
+    const struct iovec iov[] = {
+        { &h, sizeof(h) },
+        { &d, sizeof(d) },
+        { (void *)info, n_axes * sizeof(*info) },
+    };
+    record_write(iov, 3);
+}
+
+static int
+record_open(const char *path) {
+    int fd = open(path, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    if (fd < 0)
+        return log_errorf(-errno, "Failed to open %s", path);
+
+    // appending to an existing log is fine, as long as it came from the same kind of machine
+    const record_file header = { RECORD_MAGIC, sizeof(struct input_event), 0 };
+    record_file f;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return log_errorf(-errno, "Failed to stat %s", path);
+    }
+    if (st.st_size == 0) {
+        if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+            close(fd);
+            return log_errorf(-EIO, "Failed to write %s", path);
+        }
+    } else if (pread(fd, &f, sizeof(f), 0) != sizeof(f) || memcmp(&f, &header, sizeof(f))) {
+        close(fd);
+        return log_errorf(-EINVAL, "%s is not a record log of this machine", path);
+    }
+
+    g_record_fd = fd;
+    log_infof("recording to %s", path);
+    return 0;
+}
+
+static sd_event_source *g_recheck;
+
+// arms g_recheck at the earliest quarantine to lift. devices whose noisy codes
+// are masked in kernel may have nothing else to wake us up for it.
+static void
+joystick_recheck_arm(void) {
+    int r;
+
+    if (!g_recheck)
+        return;
+
+    uint64_t until = UINT64_MAX;
+    for (size_t i = 0; i < n_joysticks; ++i) {
+        const uint64_t t = g_joysticks[i].input.chatter.until;
+        if (t && t < until)
+            until = t;
+    }
+
+    if (until == UINT64_MAX) {
+        r = sd_event_source_set_enabled(g_recheck, SD_EVENT_OFF);
+        assert(r >= 0);
+        return;
+    }
+
+    r = sd_event_source_set_time(g_recheck, until);
+    if (r >= 0)
+        r = sd_event_source_set_enabled(g_recheck, SD_EVENT_ONESHOT);
+    if (r < 0)
+        log_error(r, "Failed to arm the recheck timer");
+}
+
+// only lets through key codes which are not noisy. everything passes again once noisy is empty.
+static int
+joystick_mask_keys(int fd, const unsigned long *noisy) {
+    unsigned long codes[NLONGS(KEY_CNT)];
+    for (size_t i = 0; i < NLONGS(KEY_CNT); ++i)
+        codes[i] = ~noisy[i];
+    struct input_mask mask = {
+        .type = EV_KEY,
+        .codes_size = sizeof(codes),
+        .codes_ptr = (uintptr_t)codes,
+    };
+    return ioctl(fd, EVIOCSMASK, &mask) == 0;
+}
+
+// carries out a change of chatter quarantine: noisy codes are masked in kernel,
+// so they don't even wake us up. without EVIOCSMASK they are only ignored.
+static void
+joystick_quarantine(joystick *j) {
+    chatter *ch = &j->input.chatter;
+    ch->changed = 0;
+
+    unsigned n = 0;
+    for (size_t i = 0; i < NLONGS(KEY_CNT); ++i)
+        n += __builtin_popcountl(ch->noisy[i]);
+    PROBE(quarantine, j->devname, n, ch->until);
+
+    if (n == KEY_CNT)
+        log_infof("%s %s presses faster than anyone can, ignoring it for %" PRIu64 "s",
+            j->name, j->devname, ch->delay / 1000000);
+    else if (n)
+        log_infof("ignoring %u noisy buttons of %s %s for %" PRIu64 "s",
+            n, j->name, j->devname, ch->delay / 1000000);
+    else
+        log_infof("%s %s quarantine lifted, %" PRIu64 " presses ignored so far",
+            j->name, j->devname, ch->n_ignored);
+
+    if (j->input.masked && !g_replay && !joystick_mask_keys(sd_event_source_get_io_fd(j->source), ch->noisy))
+        log_errorf(-errno, "Failed to mask noisy buttons of %s %s", j->name, j->devname);
+
+    joystick_recheck_arm();
+    metrics_changed();
+}
+
+static int
+on_recheck(sd_event_source *source, unused uint64_t usec, unused void *userdata) {
+    int r;
+
+    uint64_t now;
+    r = sd_event_now(sd_event_source_get_event(source), CLOCK_MONOTONIC, &now);
+    assert(r >= 0);
+
+    for (size_t i = 0; i < n_joysticks; ++i)
+        if (input_recheck(&g_joysticks[i].input, now))
+            joystick_quarantine(&g_joysticks[i]);
+
+    joystick_recheck_arm();
+    return 0;
+}
+
+// kernel queue overflowed and events are lost: catch up with the current key state.
+// costs an ioctl per overflow, nothing while events are read in time.
+static uint64_t
+joystick_resync(joystick *j) {
+    // replay takes the recorded state instead
+    if (g_replay)
+        return 0;
+
+    unsigned long keys[NLONGS(KEY_CNT)];
+    if (ioctl(sd_event_source_get_io_fd(j->source), EVIOCGKEY(sizeof(keys)), keys) < 0) {
+        j->input.dropped = 0;
+        log_errorf(-errno, "Failed to get key state of %s %s", j->name, j->devname);
+        return 0;
+    }
+
+    if (g_record_fd >= 0)
+        record_keys(j, keys, sizeof(keys));
+
+    const uint64_t pressed = input_resync(&j->input, keys);
+    PROBE(resync, j->devname, pressed, j->input.n_missed);
+    return pressed;
+}
+
+// counts events of a batch and returns kernel timestamp of the last button press
+// or axis movement, 0 if none
+static uint64_t
+joystick_classify(joystick *j, const struct input_event *events, size_t count) {
+    if (g_record_fd >= 0)
+        record_events(j, events, count);
+
+    uint64_t pressed = input_classify(&j->input, events, count);
+    PROBE(batch, j->devname, count, pressed);
+    if (j->input.chatter.changed)
+        joystick_quarantine(j);
+    if (j->input.dropped) {
+        const uint64_t missed = joystick_resync(j);
+        if (missed > pressed)
+            pressed = missed;
+    }
+    return pressed;
+}
+
+// drain the queue with as few syscalls as possible:
+// a short read means there is nothing more to read right now,
+// and epoll will wake us up again as soon as new events arrive.
+// *pressed is set to kernel timestamp of the last button press found.
+static int
+joystick_read(joystick *j, int fd, uint64_t *pressed) {
+    for (;;) {
+        struct input_event events[READ_BATCH];
+        const ssize_t n = read(fd, events, sizeof(events));
+        if (n < 0) {
+            if (errno == EAGAIN)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        const uint64_t t = joystick_classify(j, events, n / sizeof(*events));
+        if (t)
+            *pressed = t;
+
+        if ((size_t)n < sizeof(events))
+            return 0;
+    }
+}
+
+static uint64_t
+joystick_pressed(joystick *j, uint64_t pressed) {
+    int r;
+
+    // without kernel monotonic timestamps use the time of current event loop iteration.
+    // it is cached by sd-event, so it doesn't cost a syscall either.
+    if (!j->monotonic) {
+        r = sd_event_now(sd_event_source_get_event(j->source), CLOCK_MONOTONIC, &pressed);
+        assert(r >= 0);
+    }
+    policy_press(&j->seat->policy, pressed);
+    return pressed;
+}
+
+// the deadline is minutes away, further presses can't change anything before it.
+// stop polling the device until on_timer() collects whatever was queued meanwhile.
+// that only works if the queue holds nothing but key events with real timestamps,
+// and only once the timer is armed: nothing else unparks.
+// while the screen is blanked presses must reach saver_wake() right away.
+static void
+joystick_park(joystick *j) {
+    int r;
+
+    if (!g_config.park || !j->seat->policy.armed || j->seat->active || j->parked || j->polled)
+        return;
+    if (!j->input.masked || j->input.axes || !j->monotonic)
+        return;
+
+    r = joystick_poll(j, 0);
+    if (r < 0)
+        log_errorf(r, "Failed to park %s %s", j->name, j->devname);
+    else
+        j->parked = 1;
+}
+
+// a batch of joystick events contained a button press
+static void
+joystick_activity(joystick *j, uint64_t pressed) {
+    seat *s = j->seat;
+
+    pressed = joystick_pressed(j, pressed);
+    PROBE(press, j->devname, pressed, s->policy.state);
+    if (s->active)
+        saver_wake(s, pressed);
+    if (s->policy.state == SAVER_IDLE && !s->latency_press)
+        s->latency_press = pressed;
+
+    // timer is already armed, on_timer() will take the new deadline into account
+    if (policy_activity(&s->policy) & POLICY_ARM) {
+        // errors here must not be returned: that would disable joystick event source
+        seat_arm(s);
+        metrics_changed();
+        saver_sync(s, j->name);
+    }
+
+    joystick_park(j);
+}
+
+static int
+on_joystick_read(unused sd_event_source *s, int fd,
+    unused uint32_t revents, unused void *userdata)
+{
+    ALLOC_GUARD();
+    int r;
+    joystick *j = userdata;
+    uint64_t pressed = 0;
+
+    ++j->n_wakeups;
+    r = joystick_read(j, fd, &pressed);
+    if (r == -ENODEV) {
+        joystick_del(j);
+        return 0;
+    }
+    if (r < 0)
+        return log_errorf(r, "%s %s read failed", j->name, j->devname);
+
+    if (pressed)
+        joystick_activity(j, pressed);
+    return 0;
+}
+
+// takes a snapshot of key and tracked axes state: an ioctl per axis and one for all keys.
+// *pressed is set to now if anything changed since the last one.
+static int
+joystick_sample(joystick *j, uint64_t now, uint64_t *pressed) {
+    const int fd = sd_event_source_get_io_fd(j->source);
+
+    unsigned long keys[NLONGS(KEY_CNT)];
+    if (ioctl(fd, EVIOCGKEY(sizeof(keys)), keys) < 0)
+        return -errno;
+
+    if (j->input.axes)
+        for (uint64_t t = j->input.axes->tracked; t; t &= t - 1) {
+            const int c = __builtin_ctzll(t);
+            struct input_absinfo info;
+            if (ioctl(fd, EVIOCGABS(c), &info) < 0)
+                return -errno;
+            j->input.axes->value[c] = info.value;
+        }
+
+    *pressed = input_sample(&j->input, keys, now);
+    return 0;
+}
+
+static sd_event_source *g_poll;
+
+// samples every polled joystick at once: wakeups only depend on g_config.poll,
+// no matter how many events the joysticks generate
+static int
+on_poll(sd_event_source *source, unused uint64_t usec, unused void *userdata) {
+    ALLOC_GUARD();
+    int r;
+
+    uint64_t now;
+    r = sd_event_now(sd_event_source_get_event(source), CLOCK_MONOTONIC, &now);
+    assert(r >= 0);
+
+    // go backwards: removal moves the last joystick into freed slot
+    for (size_t i = n_joysticks; i-- > 0;) {
+        joystick *j = &g_joysticks[i];
+        if (!j->polled)
+            continue;
+
+        ++j->n_wakeups;
+        uint64_t pressed = 0;
+        r = joystick_sample(j, now, &pressed);
+        if (r == -ENODEV) {
+            joystick_del(j);
+            continue;
+        }
+        if (r < 0) {
+            log_errorf(r, "Failed to sample %s %s", j->name, j->devname);
+            continue;
+        }
+
+        if (pressed)
+            joystick_activity(j, pressed);
+    }
+
+    // from now rather than the scheduled time: after a suspend or a stall the timer
+    // would fire back to back until it caught up
+    return sd_event_source_set_time(source, now + g_config.poll);
+}
+
+#ifdef HAVE_LIBURING
+static int
+on_uring(unused sd_event_source *s, int fd, unused uint32_t revents, unused void *userdata) {
+    ALLOC_GUARD();
+
+    // reset eventfd counter, completions are taken straight from the ring
+    uint64_t v;
+    if (read(fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+        return log_error(-errno, "Failed to read io_uring eventfd");
+
+    struct io_uring_cqe *cqe;
+    unsigned head, n = 0, bufs = 0;
+    io_uring_for_each_cqe(&g_ring, head, cqe) {
+        ++n;
+        joystick *j = cqe->user_data ? joystick_find((dev_t)cqe->user_data) : NULL;
+
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            const unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            uint8_t *buf = g_bufs + bid * URING_BUF_SIZE;
+            if (j && cqe->res > 0) {
+                ++j->n_wakeups;
+                const uint64_t pressed = joystick_classify(j,
+                    (const struct input_event *)buf, cqe->res / sizeof(struct input_event));
+                if (pressed)
+                    joystick_activity(j, pressed);
+            }
+            io_uring_buf_ring_add(g_buf_ring, buf, URING_BUF_SIZE, bid,
+                io_uring_buf_ring_mask(URING_BUFS), bufs++);
+        }
+
+        if (!j || (cqe->flags & IORING_CQE_F_MORE))
+            continue;
+
+        // multishot read is over
+        if (cqe->res == -ENODEV)
+            joystick_del(j);
+        else if (!j->parked) {
+            // e.g. ran out of buffers: they are recycled below, just arm it again
+            if (cqe->res < 0 && cqe->res != -ENOBUFS)
+                log_errorf(cqe->res, "%s %s read failed", j->name, j->devname);
+            uring_queue(j, 1);
+        }
+    }
+
+    io_uring_buf_ring_advance(g_buf_ring, bufs);
+    io_uring_cq_advance(&g_ring, n);
+    if (io_uring_sq_ready(&g_ring))
+        io_uring_submit(&g_ring);
+    return 0;
+}
+
+static void
+uring_fini(void) {
+    g_uring_source = sd_event_source_disable_unref(g_uring_source);
+    if (g_buf_ring)
+        io_uring_free_buf_ring(&g_ring, g_buf_ring, URING_BUFS, URING_BGID);
+    g_buf_ring = NULL;
+    if (g_ring.ring_fd > 0)
+        io_uring_queue_exit(&g_ring);
+    g_ring.ring_fd = 0;
+    free(g_bufs);
+    g_bufs = NULL;
+}
+
+static int
+uring_init(sd_event *ev) {
+    int r;
+
+    r = io_uring_queue_init(URING_ENTRIES, &g_ring, 0);
+    if (r < 0)
+        return log_error(r, "Failed to create io_uring");
+
+    // multishot read needs linux 6.7
+    struct io_uring_probe *probe = io_uring_get_probe_ring(&g_ring);
+    const int supported = probe && io_uring_opcode_supported(probe, IORING_OP_READ_MULTISHOT);
+    io_uring_free_probe(probe);
+    if (!supported) {
+        uring_fini();
+        return log_error(-EOPNOTSUPP, "io_uring multishot read is not available");
+    }
+
+    g_buf_ring = io_uring_setup_buf_ring(&g_ring, URING_BUFS, URING_BGID, 0, &r);
+    if (!g_buf_ring) {
+        uring_fini();
+        return log_error(r, "Failed to register io_uring buffers");
+    }
+
+    g_bufs = malloc(URING_BUFS * URING_BUF_SIZE);
+    if (!g_bufs) {
+        uring_fini();
+        return log_error(-ENOMEM, "Failed to allocate io_uring buffers");
+    }
+
+    for (unsigned i = 0; i < URING_BUFS; ++i)
+        io_uring_buf_ring_add(g_buf_ring, g_bufs + i * URING_BUF_SIZE, URING_BUF_SIZE, i,
+            io_uring_buf_ring_mask(URING_BUFS), i);
+    io_uring_buf_ring_advance(g_buf_ring, URING_BUFS);
+
+    int fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    if (fd < 0) {
+        uring_fini();
+        return log_error(-errno, "Failed to create eventfd");
+    }
+
+    r = io_uring_register_eventfd(&g_ring, fd);
+    if (r < 0) {
+        close(fd);
+        uring_fini();
+        return log_error(r, "Failed to register io_uring eventfd");
+    }
+
+    r = sd_event_add_io(ev, &g_uring_source, fd, EPOLLIN, on_uring, NULL);
+    if (r < 0) {
+        close(fd);
+        uring_fini();
+        return log_error(r, "Failed to add io_uring to event loop");
+    }
+
+    r = sd_event_source_set_io_fd_own(g_uring_source, 1);
+    assert(r >= 0);
+
+    log_info("using io_uring backend");
+    return 0;
+}
+#endif
+
+// resume polling of parked joysticks of seat s, or of all seats if it is NULL,
+// and collect presses queued while they were parked
+static void
+joystick_unpark(const seat *s) {
+    int r;
+
+    // go backwards: removal moves the last joystick into freed slot
+    for (size_t i = n_joysticks; i-- > 0;) {
+        joystick *j = &g_joysticks[i];
+        if (!j->parked || (s && j->seat != s))
+            continue;
+
+        // drain the queue before polling again: io_uring submits the read right away,
+        // and presses it takes would only reach the policy after the deadline decision
+        uint64_t pressed = 0;
+        r = joystick_read(j, sd_event_source_get_io_fd(j->source), &pressed);
+        if (r == -ENODEV) {
+            joystick_del(j);
+            continue;
+        }
+        if (r < 0)
+            log_errorf(r, "%s %s read failed", j->name, j->devname);
+
+        // the timer which would try again may never be armed: don't keep a dead device
+        r = joystick_poll(j, 1);
+        if (r < 0) {
+            log_errorf(r, "Failed to unpark %s %s, dropping it", j->name, j->devname);
+            joystick_del(j);
+            continue;
+        }
+        j->parked = 0;
+
+        if (pressed)
+            joystick_pressed(j, pressed);
+    }
+}
+
+static int
+joystick_set_types(int fd, unsigned long types) {
+    // type 0 selects the mask of event types rather than codes of EV_SYN.
+    // EV_SYN itself is never filtered, but kernel drops SYN_REPORT of frames
+    // left empty, so untracked axis movements don't wake us up at all.
+    struct input_mask mask = {
+        .type = 0,
+        .codes_size = sizeof(types),
+        .codes_ptr = (uintptr_t)&types,
+    };
+    return ioctl(fd, EVIOCSMASK, &mask) == 0;
+}
+
+static int
+joystick_set_mask(int fd, uint64_t abs) {
+    unsigned long types = 1UL << EV_KEY;
+    if (abs)
+        types |= 1UL << EV_ABS;
+    if (!joystick_set_types(fd, types))
+        return 0;
+
+    unsigned long codes[NLONGS(ABS_CNT)] = {0};
+    for (unsigned i = 0; i < ABS_CNT; ++i)
+        if (abs & (1ULL << i))
+            codes[i / BITS_PER_LONG] |= 1UL << (i % BITS_PER_LONG);
+    struct input_mask mask = {
+        .type = EV_ABS,
+        .codes_size = sizeof(codes),
+        .codes_ptr = (uintptr_t)codes,
+    };
+    return ioctl(fd, EVIOCSMASK, &mask) == 0;
+}
+
+// starts tracking axis c of j, with the range and resting value from info
+static int
+joystick_axis_add(joystick *j, unsigned c, const struct input_absinfo *info) {
+    const int r = input_axis_add(&j->input, c, info, g_config.deadzone, g_config.threshold);
+    if (r < 0)
+        return log_errorf(r, "Failed to track axes of %s %s", j->name, j->devname);
+    return 0;
+}
+
+// (re)configures axis detection of an open joystick according to g_config
+static void
+joystick_axes_init(joystick *j) {
+    const int fd = sd_event_source_get_io_fd(j->source);
+
+    free(j->input.axes);
+    j->input.axes = NULL;
+
+    struct input_absinfo tracked[ABS_MISC];
+    size_t n_tracked = 0;
+    unsigned long bits[NLONGS(ABS_CNT)] = {0};
+    if (g_config.axes && ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(bits)), bits) >= 0) {
+        // sticks, triggers, pedals, wheels and hats. multitouch and friends are not play
+        for (unsigned c = 0; c < ABS_MISC; ++c) {
+            struct input_absinfo *info = &tracked[n_tracked];
+            if (!test_bit(bits, c) || ioctl(fd, EVIOCGABS(c), info) < 0 || info->maximum <= info->minimum)
+                continue;
+            if (joystick_axis_add(j, c, info) < 0)
+                break;
+            ++n_tracked;
+        }
+    }
+
+    // EVIOCSMASK is available since linux 4.4, older kernels just deliver everything.
+    // polled joysticks are read with ioctls, nothing has to be queued for them at all.
+    if (j->polled)
+        j->input.masked = joystick_set_types(fd, 0);
+    else
+        j->input.masked = joystick_set_mask(fd, j->input.axes ? j->input.axes->tracked : 0);
+
+    if (g_record_fd >= 0)
+        record_device_add(j, tracked);
+}
+
+static seat *seat_get(sd_event *ev, const char *name);
+
+// logind puts devices on other seats than seat0 with ID_SEAT udev property
+static seat *
+joystick_seat(sd_event *ev, sd_device *d) {
+    if (!g_config.system)
+        return &g_seats[0];
+
+    const char *name;
+    if (sd_device_get_property_value(d, "ID_SEAT", &name) < 0 || !name[0])
+        name = "seat0";
+    return seat_get(ev, name);
+}
+
+static int
+joystick_add(sd_event *ev, sd_device *d, const char *devname, const char *name) {
+    int r;
+
+    dev_t devnum;
+    r = sd_device_get_devnum(d, &devnum);
+    if (r < 0)
+        return log_errorf(r, "Failed to get %s %s device number", name, devname);
+
+    // the same device may be reported by both enumeration and hotplug monitor
+    if (joystick_find(devnum))
+        return 0;
+
+    seat *s = joystick_seat(ev, d);
+    if (!s)
+        return log_errorf(-ENOMEM, "Failed to find seat of %s %s", name, devname);
+
+    r = joystick_reserve();
+    if (r < 0)
+        return log_errorf(r, "Failed to track %s %s", name, devname);
+
+    int fd = open(devname, O_RDONLY|O_CLOEXEC|O_NONBLOCK);
+    if (fd < 0)
+        return log_errorf(-errno, "Failed to open %s device %s", name, devname);
+
+    // have press timestamps in the same clock as event loop, so they can be used for deadline.
+    // older kernels don't support it, fall back to event loop time then.
+    const int clock = CLOCK_MONOTONIC;
+    const int monotonic = ioctl(fd, EVIOCSCLOCKID, &clock) == 0;
+
+    joystick *j = &g_joysticks[n_joysticks];
+    r = sd_event_add_io(ev, &j->source, fd, EPOLLIN, on_joystick_read, j);
+    if (r < 0) {
+        close(fd);
+        return log_errorf(r, "Failed to add %s %s to event loop", name, devname);
+    }
+
+    r = sd_event_source_set_io_fd_own(j->source, 1);
+    assert(r >= 0);
+
+    r = sd_event_source_set_destroy_callback(j->source, joystick_destroy);
+    assert(r >= 0);
+
+    j->dev = sd_device_ref(d);
+    j->seat = s;
+    j->devnum = devnum;
+    j->devname = devname;
+    j->name = name;
+    j->input = (input){0};
+    j->n_wakeups = 0;
+    j->parked = 0;
+    j->polled = g_config.poll != 0;
+    j->monotonic = monotonic;
+    joystick_axes_init(j);
+
+    // the source only keeps the fd, g_poll takes snapshots from the state seen here on
+    if (j->polled) {
+        r = sd_event_source_set_enabled(j->source, SD_EVENT_OFF);
+        assert(r >= 0);
+        if (ioctl(fd, EVIOCGKEY(sizeof(j->input.keys)), j->input.keys) < 0)
+            log_errorf(-errno, "Failed to get key state of %s %s", name, devname);
+    }
+
+    PROBE(add, devname, name, s->name);
+    log_infof("+%zd: %s %s mask=%s axes=%d%s", n_joysticks, devname, name, j->input.masked ? "on" : "off",
+        j->input.axes ? __builtin_popcountll(j->input.axes->tracked) : 0, j->polled ? " polled" : "");
+    index_insert(n_joysticks);
+    ++n_joysticks;
+    status_emit("add", s, j);
+    idle_check();
+
+#ifdef HAVE_LIBURING
+    if (g_uring_source && !j->polled) {
+        r = sd_event_source_set_enabled(j->source, SD_EVENT_OFF);
+        assert(r >= 0);
+
+        r = joystick_poll(j, 1);
+        if (r < 0)
+            log_errorf(r, "Failed to start reading %s %s", name, devname);
+    }
+#endif
+    metrics_changed();
+    return 0;
+}
+
+static void
+joystick_del_all(void) {
+    while (n_joysticks) {
+        joystick *j = &g_joysticks[n_joysticks - 1];
+        joystick_del(j);
+    }
+}
+
+static int
+joystick_exit(unused sd_event_source *s, unused void *userdata) {
+    joystick_del_all();
+    joystick_free_all();
+#ifdef HAVE_LIBURING
+    uring_fini();
+#endif
+    return 0;
+}
+
+static int
+on_device_changed(sd_device_monitor *m, sd_device *d, unused void *userdata) {
+    int r;
+
+    sd_device_action_t a;
+    r = sd_device_get_action(d, &a);
+    assert(r >= 0);
+    PROBE(device__changed, a);
+
+    // read() fails with ENODEV too, but the device might be parked and not read for minutes
+    if (a == SD_DEVICE_REMOVE) {
+        dev_t devnum;
+        joystick *j;
+        if (sd_device_get_devnum(d, &devnum) >= 0 && (j = joystick_find(devnum)))
+            joystick_del(j);
+        return 0;
+    }
+
+    const char *devname, *name;
+    r = joystick_probe(d, &devname, &name);
+    if (r <= 0)
+        return 0;
+
+    if (a == SD_DEVICE_ADD)
+        joystick_add(sd_device_monitor_get_event(m), d, devname, name);
+    return 0;
+}
+
+// joysticks are tagged by udev rule installed along with joynosleep.
+// the tag is used only if the rule is there, e.g. not when running from build directory.
+static void
+udev_tag_init(void) {
+#ifdef UDEV_TAG
+    static const char *const dirs[] = {
+        "/etc/udev/rules.d",
+        "/run/udev/rules.d",
+        "/usr/local/lib/udev/rules.d",
+        "/usr/lib/udev/rules.d",
+        "/lib/udev/rules.d",
+    };
+
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(*dirs); ++i) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/70-%s.rules", dirs[i], UDEV_TAG);
+        if (access(path, F_OK) == 0) {
+            g_udev_tag = UDEV_TAG;
+            log_infof("using udev tag %s from %s", UDEV_TAG, path);
+            return;
+        }
+    }
+
+    log_infof("udev rule for %s tag is not installed, filtering devices in userspace", UDEV_TAG);
+#endif
+}
+
+static int
+joystick_monitor_init(sd_event *ev) {
+    int r;
+
+    cleanup(sd_device_monitor_unrefp) sd_device_monitor *m = NULL;
+    r = sd_device_monitor_new(&m);
+    if (r < 0)
+        return log_error(r, "Failed to init udev monitor");
+
+    r = sd_device_monitor_filter_add_match_subsystem_devtype(m, "input", NULL);
+    if (r < 0)
+        return log_error(r, "Failed to add subsystem match to udev monitor");
+
+    // matches are compiled into BPF filter on the netlink socket,
+    // so events of other devices are dropped in kernel and don't wake us up
+    if (g_udev_tag) {
+        r = sd_device_monitor_filter_add_match_tag(m, g_udev_tag);
+        if (r < 0)
+            return log_error(r, "Failed to add tag match to udev monitor");
+    }
+
+    r = sd_device_monitor_attach_event(m, ev);
+    if (r < 0)
+        return log_error(r, "Failed to attach udev monitor");
+
+    g_monitor = sd_device_monitor_ref(m);
+    return 0;
+}
+
+static void
+joystick_monitor_start(void) {
+    if (!g_monitor)
+        return;
+
+    int r;
+    r = sd_device_monitor_start(g_monitor, on_device_changed, NULL);
+    if (r < 0) {
+        log_error(r, "Failed to start udev monitor");
+        g_monitor = sd_device_monitor_unref(g_monitor);
+    } else
+        log_infof("started joystick hotplug monitor...");
+}
+
+static void
+joystick_monitor_stop(void) {
+    if (!g_monitor)
+        return;
+
+    int r;
+    r = sd_device_monitor_stop(g_monitor);
+    if (r < 0)
+        log_error(r, "Failed to stop udev monitor");
+}
+
+static int
+joystick_enumerator(sd_device_enumerator **ret) {
+    int r;
+
+    cleanup(sd_device_enumerator_unrefp) sd_device_enumerator *e = NULL;
+    r = sd_device_enumerator_new(&e);
+    if (r < 0)
+        return log_error(r, "Failed to create device enumerator");
+
+    r = sd_device_enumerator_add_match_subsystem(e, "input", 1);
+    if (r < 0)
+        return log_error(r, "Failed to add subsystem match");
+
+    // sysname is checked before device is loaded, so inputN and mouseN nodes are skipped cheaply
+    r = sd_device_enumerator_add_match_sysname(e, "event*");
+    if (r < 0)
+        return log_error(r, "Failed to add sysname match");
+
+    r = sd_device_enumerator_add_match_property(e, "ID_INPUT_JOYSTICK", "1");
+    if (r < 0)
+        return log_error(r, "Failed to add property match");
+
+    // with a tag, only devices listed in /run/udev/tags are looked at
+    if (g_udev_tag) {
+        r = sd_device_enumerator_add_match_tag(e, g_udev_tag);
+        if (r < 0)
+            return log_error(r, "Failed to add tag match");
+    }
+
+    *ret = e;
+    e = NULL;
+    return 0;
+}
+
+static int
+joystick_enumerate(sd_event *ev) {
+    int r;
+
+    cleanup(sd_device_enumerator_unrefp) sd_device_enumerator *e = NULL;
+    r = joystick_enumerator(&e);
+    if (r < 0)
+        return r;
+
+    int inputs = 0, joysticks = 0;
+    sd_device *d;
+    for (d = sd_device_enumerator_get_device_first(e);
+         d;
+         d = sd_device_enumerator_get_device_next(e))
+    {
+        ++inputs;
+        const char *devname, *name;
+        r = joystick_probe(d, &devname, &name);
+        if (r <= 0)
+            continue;
+
+        ++joysticks;
+        joystick_add(ev, d, devname, name);
+    }
+
+    log_infof("Found %d inputs, %d joysticks, %zd tracked",
+        inputs, joysticks, n_joysticks);
+    return 0;
+}
+
+// joysticks we don't read are still plugged in: without a screen saver, or failing to open.
+// udev only starts us when one is added, so going away with them would be for good.
+static int
+joystick_plugged(void) {
+    cleanup(sd_device_enumerator_unrefp) sd_device_enumerator *e = NULL;
+    if (joystick_enumerator(&e) < 0)
+        return 1;
+
+    for (sd_device *d = sd_device_enumerator_get_device_first(e);
+         d;
+         d = sd_device_enumerator_get_device_next(e))
+    {
+        const char *devname, *name;
+        if (joystick_probe(d, &devname, &name) > 0)
+            return 1;
+    }
+    return 0;
+}
+
+// joysticks are only read while there is something to inhibit screen saver with
+static void
+inhibitors_changed(void) {
+    int present = 0;
+    for (size_t n = 0; n < n_seats && !present; ++n)
+        present = inhibitor_pick(&g_seats[n]) != NULL;
+    if (present == g_saver_present)
+        return;
+
+    g_saver_present = present;
+    if (present) {
+        log_info("screen saver appeared");
+        joystick_enumerate(sd_bus_get_event(g_bus));
+        joystick_monitor_start();
+    } else {
+        log_info("waiting for screen saver to appear...");
+        for (size_t n = 0; n < n_seats; ++n)
+            saver_reset(&g_seats[n]);
+        // screen saver is gone, no need to read joysticks
+        joystick_monitor_stop();
+        joystick_del_all();
+    }
+}
+
+static void
+saver_active_changed(seat *s, int active) {
+    if (!active && s->wake_press) {
+        const uint64_t now = now_usec();
+        g_metrics.wake_usec = now > s->wake_press ? now - s->wake_press : 0;
+        latency_record(g_wake_latency, g_metrics.wake_usec);
+        log_infof("screen woke up in %" PRIu64 "us", g_metrics.wake_usec);
+        s->wake_press = 0;
+        metrics_changed();
+    }
+    s->active = active;
+
+    // the screen blanked during a deadline: parked joysticks would keep presses
+    // that should wake it up until on_timer()
+    if (active)
+        joystick_unpark(s);
+}
+
+static int
+on_active_changed(sd_bus_message *m, void *userdata, unused sd_bus_error *ret_error) {
+    int r, v;
+
+    r = sd_bus_message_read_basic(m, 'b', &v);
+    if (r < 0)
+        return log_error(r, "Failed to read ActiveChanged signal");
+
+    saver_active_changed(userdata, v);
+    return 0;
+}
+
+static int
+on_get_active_reply(sd_bus_message *m, void *userdata, unused sd_bus_error *ret_error) {
+    int r, v;
+
+    // not every implementation has it, ActiveChanged still works then
+    if (sd_bus_message_is_method_error(m, NULL))
+        return 0;
+
+    r = sd_bus_message_read_basic(m, 'b', &v);
+    if (r < 0)
+        return log_error(r, "Failed to read GetActive reply");
+
+    saver_active_changed(userdata, v);
+    return 0;
+}
+
+static void
+inhibitor_appeared(seat *s, inhibitor *i) {
+    log_infof("%s appeared%s%s", i->name, s->name ? " on " : "", s->name ? s->name : "");
+    s->present |= 1U << (i - g_inhibitors);
+    if (i->service && !strcmp(i->service, SAVER))
+        dbus_call_async(s->bus, NULL, on_get_active_reply, s, SAVER, SAVER_PATH, SAVER,
+            "GetActive", "");
+    inhibitors_changed();
+
+    // presses on the seat might have been waiting for it
+    saver_sync(s, NULL);
+}
+
+static void
+inhibitor_disappeared(seat *s, inhibitor *i) {
+    log_infof("%s disappeared%s%s", i->name, s->name ? " on " : "", s->name ? s->name : "");
+    s->present &= ~(1U << (i - g_inhibitors));
+    if (i->service && !strcmp(i->service, SAVER)) {
+        s->active = 0;
+        s->wake_press = 0;
+    }
+    if (i == s->inhibitor)
+        saver_forget(s);
+    inhibitors_changed();
+
+    // still wanted: take it with another one
+    if (g_saver_present)
+        saver_sync(s, NULL);
+}
+
+// seat whose inhibitors live on the bus. in session mode logind
+// inhibitor of our own session is on the system bus.
+static seat *
+seat_of_bus(sd_bus *bus) {
+    for (size_t n = 0; n < n_seats; ++n)
+        if (g_seats[n].bus == bus)
+            return &g_seats[n];
+    if (!g_config.system && n_seats && bus == g_system_bus)
+        return &g_seats[0];
+    return NULL;
+}
+
+static int
+on_name_owner_changed(sd_bus_message *m,
+    unused void *userdata,
+    unused sd_bus_error *ret_error)
+{
+    int r;
+    const char *name, *old_owner, *new_owner;
+    r = sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner);
+    if (r < 0)
+        return log_error(r, "Failed to read NameOwnerChanged reply");
+
+    sd_bus *bus = sd_bus_message_get_bus(m);
+    seat *s = seat_of_bus(bus);
+    if (!s)
+        return 0;
+
+    const int system = bus != s->bus;
+    for (size_t n = 0; n < N_INHIBITORS; ++n) {
+        inhibitor *i = &g_inhibitors[n];
+        if (!i->service || i->system != system || strcmp(name, i->service))
+            continue;
+
+        if (!new_owner || !new_owner[0])
+            inhibitor_disappeared(s, i);
+        else if (!(s->present & 1U << n))
+            inhibitor_appeared(s, i);
+    }
+
+    return 0;
+}
+
+static int
+on_name_has_owner_reply(sd_bus_message *m, void *userdata, unused sd_bus_error *ret_error) {
+    inhibitor *i = userdata;
+    int r;
+
+    if (sd_bus_message_is_method_error(m, NULL))
+        return log_reply_error(m, "NameHasOwner");
+
+    int v;
+    r = sd_bus_message_read_basic(m, 'b', &v);
+    if (r < 0)
+        return log_error(r, "Failed to read NameHasOwner reply");
+
+    // the seat might have switched to another session meanwhile
+    seat *s = seat_of_bus(sd_bus_message_get_bus(m));
+    if (s && v && !(s->present & 1U << (i - g_inhibitors)))
+        inhibitor_appeared(s, i);
+    return 0;
+}
+
+static int
+watch_inhibitors(seat *s, sd_bus *bus) {
+    int r;
+
+    // subscribe before asking, so services appearing in between aren't missed
+    r = sd_bus_match_signal(bus, NULL, DBUS, DBUS_PATH, DBUS, "NameOwnerChanged",
+        on_name_owner_changed, NULL);
+    if (r < 0)
+        return log_error(r, "Failed to add NameOwnerChanged match");
+
+    const int system = bus != s->bus;
+    // wake on press needs to know if the screen is blank
+    if (!system) {
+        r = sd_bus_match_signal(bus, NULL, SAVER, SAVER_PATH, SAVER, "ActiveChanged",
+            on_active_changed, s);
+        if (r < 0)
+            log_error(r, "Failed to add ActiveChanged match");
+    }
+    for (size_t n = 0; n < N_INHIBITORS; ++n) {
+        inhibitor *i = &g_inhibitors[n];
+        if (i->service && i->system == system)
+            dbus_call_async(bus, NULL, on_name_has_owner_reply, i, DBUS, DBUS_PATH, DBUS,
+                "NameHasOwner", "s", i->service);
+    }
+
+    return 0;
+}
+
+#ifdef HAVE_X11
+static int
+on_x11_event(unused sd_event_source *s, unused int fd, unused uint32_t revents,
+    unused void *userdata)
+{
+    // nothing is selected, but errors and replies still have to be drained
+    while (XPending(g_display)) {
+        XEvent e;
+        XNextEvent(g_display, &e);
+    }
+    return 0;
+}
+
+static int
+on_x11_heartbeat(sd_event_source *s, uint64_t usec, unused void *userdata) {
+    XResetScreenSaver(g_display);
+    XFlush(g_display);
+    return sd_event_source_set_time(s, usec + x11_heartbeat);
+}
+
+static int
+x11_fini(unused sd_event_source *s, unused void *userdata) {
+    XCloseDisplay(g_display);
+    g_display = NULL;
+    return 0;
+}
+
+// X connection is opened once: Xlib exits the process when the server goes away,
+// so x11 inhibitor never disappears.
+static int
+x11_init(sd_event *ev) {
+    int r;
+
+    if (!getenv("DISPLAY"))
+        return 0;
+
+    g_display = XOpenDisplay(NULL);
+    if (!g_display)
+        return log_error(-ECONNREFUSED, "Can't open X display");
+
+    int event_base, error_base;
+    if (!XScreenSaverQueryExtension(g_display, &event_base, &error_base)) {
+        XCloseDisplay(g_display);
+        g_display = NULL;
+        return log_error(-EOPNOTSUPP, "X server has no MIT-SCREEN-SAVER extension");
+    }
+
+    r = sd_event_add_exit(ev, NULL, x11_fini, NULL);
+    assert(r >= 0);
+
+    r = sd_event_add_io(ev, NULL, ConnectionNumber(g_display), EPOLLIN, on_x11_event, NULL);
+    if (r < 0)
+        return log_error(r, "Failed to add X connection to event loop");
+
+    r = sd_event_add_time_relative(ev, &g_x11_heartbeat, CLOCK_MONOTONIC, x11_heartbeat,
+        x11_heartbeat / 10, on_x11_heartbeat, NULL);
+    if (r < 0)
+        return log_error(r, "Failed to initialize X11 heartbeat");
+
+    r = sd_event_source_set_enabled(g_x11_heartbeat, SD_EVENT_OFF);
+    assert(r >= 0);
+
+    inhibitor_appeared(&g_seats[0], &g_inhibitors[INHIBITOR_X11]);
+    return 0;
+}
+#endif
+
+static int on_timer(sd_event_source *source, uint64_t usec, void *userdata);
+
+static seat *
+seat_new(sd_event *ev, const char *name) {
+    int r;
+
+    if (n_seats == MAX_SEATS) {
+        log_errorf(-E2BIG, "Too many seats, ignoring %s", name);
+        return NULL;
+    }
+
+    seat *s = &g_seats[n_seats];
+    *s = (seat){ .fd = -1 };
+    policy_init(&s->policy, g_config.timeout);
+    if (name && !(s->name = strdup(name))) {
+        log_error(-ENOMEM, "Failed to add seat");
+        return NULL;
+    }
+
+    r = sd_event_add_time_relative(ev, &s->timer, CLOCK_MONOTONIC,
+        g_config.timeout, g_config.accuracy, on_timer, s);
+    if (r < 0) {
+        free(s->name);
+        log_error(r, "Failed to initialize timerfd");
+        return NULL;
+    }
+
+    r = sd_event_source_set_enabled(s->timer, SD_EVENT_OFF);
+    assert(r >= 0);
+
+    r = sd_event_add_time_relative(ev, &s->retry, CLOCK_MONOTONIC,
+        POLICY_RETRY_MIN, 0, on_retry, s);
+    if (r < 0) {
+        sd_event_source_unref(s->timer);
+        free(s->name);
+        log_error(r, "Failed to initialize retry timer");
+        return NULL;
+    }
+
+    r = sd_event_source_set_enabled(s->retry, SD_EVENT_OFF);
+    assert(r >= 0);
+
+    ++n_seats;
+    return s;
+}
+
+// session buses only let their owner in. credentials are taken by connect()
+// and EXTERNAL auth, both done by sd_bus_start() on a unix socket,
+// so the connection is made with effective uid of the session owner.
+static int
+seat_connect(seat *s, sd_event *ev, uid_t uid) {
+    cleanup(sd_bus_unrefp) sd_bus *bus = NULL;
+    int r;
+
+    r = sd_bus_new(&bus);
+    if (r < 0)
+        return log_error(r, "Failed to allocate bus");
+
+    char address[64];
+    snprintf(address, sizeof(address), "unix:path=/run/user/%u/bus", (unsigned)uid);
+    r = sd_bus_set_address(bus, address);
+    if (r < 0)
+        return log_error(r, "Failed to set bus address");
+
+    r = sd_bus_set_bus_client(bus, 1);
+    assert(r >= 0);
+
+    if (seteuid(uid) < 0)
+        return log_errorf(-errno, "Failed to switch to uid %u", (unsigned)uid);
+    r = sd_bus_start(bus);
+    // running on with somebody else's uid is not an option
+    if (seteuid(0) < 0)
+        abort();
+    if (r < 0)
+        return log_errorf(r, "Failed to connect to %s", address);
+
+    r = sd_bus_attach_event(bus, ev, SD_EVENT_PRIORITY_NORMAL);
+    if (r < 0)
+        return log_error(r, "Failed to attach session bus to event loop");
+
+    s->bus = bus;
+    bus = NULL;
+    return watch_inhibitors(s, s->bus);
+}
+
+// leaving the session: services drop inhibitions of clients which went away,
+// so closing the connection releases whatever was held there
+static void
+seat_disconnect(seat *s) {
+    saver_forget(s);
+    s->present = 0;
+    s->active = 0;
+    s->wake_press = 0;
+    s->bus = sd_bus_flush_close_unref(s->bus);
+    free(s->session);
+    s->session = NULL;
+}
+
+// follows the active session of the seat, inhibit state stays with the seat
+static void
+seat_update(seat *s, sd_event *ev) {
+    cleanup(freep) char *session = NULL;
+    uid_t uid;
+
+    if (sd_seat_get_active(s->name, &session, &uid) < 0)
+        session = NULL;
+    if (session && s->session && !strcmp(session, s->session))
+        return;
+    if (!session && !s->session)
+        return;
+
+    if (s->session) {
+        log_infof("%s: left session %s", s->name, s->session);
+        seat_disconnect(s);
+    }
+
+    // on failure the next logind change tries again
+    if (session) {
+        log_infof("%s: active session %s of uid %u", s->name, session, (unsigned)uid);
+        if (seat_connect(s, ev, uid) >= 0) {
+            s->session = session;
+            session = NULL;
+        }
     }
 
-    ++j->n_events;
-    if (!is_button_press(event))
-        return 0;
+    inhibitors_changed();
+}
 
-    if (!g_cookie) {
-        r = saver_inhibit(g_bus, j->name, &g_cookie);
-        if (r < 0)
-            return r;
+static seat *
+seat_get(sd_event *ev, const char *name) {
+    for (size_t n = 0; n < n_seats; ++n)
+        if (!strcmp(g_seats[n].name, name))
+            return &g_seats[n];
+
+    seat *s = seat_new(ev, name);
+    if (s)
+        seat_update(s, ev);
+    return s;
+}
+
+static void
+login_refresh(sd_event *ev) {
+    char **seats = NULL;
+    const int n = sd_get_seats(&seats);
+    if (n < 0) {
+        log_error(n, "Failed to list seats");
+        return;
     }
 
-    r = sd_event_source_set_time_relative(g_timer, g_inhibit_timeout);
-    if (r < 0)
-        return log_error(r, "Failed to reset the timer");
+    for (int i = 0; i < n; ++i) {
+        seat_get(ev, seats[i]);
+        free(seats[i]);
+    }
+    free(seats);
 
-    r = sd_event_source_set_enabled(g_timer, SD_EVENT_ONESHOT);
-    if (r < 0)
-        return log_error(r, "Failed to enable the timer");
+    // gone seats have no active session anymore
+    for (size_t i = 0; i < n_seats; ++i)
+        seat_update(&g_seats[i], ev);
+}
 
+static int
+on_login_changed(sd_event_source *source, unused int fd, unused uint32_t revents, void *userdata) {
+    sd_login_monitor_flush(userdata);
+    login_refresh(sd_event_source_get_event(source));
     return 0;
 }
 
+static void
+login_monitor_destroy(void *userdata) {
+    sd_login_monitor_unref(userdata);
+}
+
 static int
-joystick_add(sd_event *ev, sd_device *d, const char *devname, const char *name) {
+login_init(sd_event *ev) {
+    sd_login_monitor *m;
+    sd_event_source *source;
     int r;
 
-    assert(n_joysticks < MAX_JOYSTICKS);
-
-    int fd = open(devname, O_RDONLY|O_CLOEXEC|O_NONBLOCK);
-    if (fd < 0)
-        return log_errorf(-errno, "Failed to open %s device %s", name, devname);
+    r = sd_login_monitor_new(NULL, &m);
+    if (r < 0)
+        return log_error(r, "Failed to monitor logind");
 
-    joystick *j = &g_joysticks[n_joysticks];
-    r = sd_event_add_io(ev, &j->source, fd, EPOLLIN, on_joystick_read, j);
+    r = sd_event_add_io(ev, &source, sd_login_monitor_get_fd(m), sd_login_monitor_get_events(m),
+        on_login_changed, m);
     if (r < 0) {
-        close(fd);
-        return log_errorf(r, "Failed to add %s %s to event loop", name, devname);
+        sd_login_monitor_unref(m);
+        return log_error(r, "Failed to add logind monitor to event loop");
     }
 
-    r = sd_event_source_set_io_fd_own(j->source, 1);
+    r = sd_event_source_set_destroy_callback(source, login_monitor_destroy);
     assert(r >= 0);
-
-    r = sd_event_source_set_destroy_callback(j->source, joystick_destroy);
+    r = sd_event_source_set_floating(source, 1);
     assert(r >= 0);
+    sd_event_source_unref(source);
 
-    j->dev = sd_device_ref(d);
-    j->devname = devname;
-    j->name = name;
-    j->n_events = 0;
-
-    log_infof("+%zd: %s %s", n_joysticks, devname, name);
-    ++n_joysticks;
+    login_refresh(ev);
     return 0;
 }
 
-static void
-joystick_del_all(void) {
-    while (n_joysticks) {
-        joystick *j = &g_joysticks[n_joysticks - 1];
-        joystick_del(j);
-    }
-}
-
 static int
-joystick_exit(unused sd_event_source *s, unused void *userdata) {
-    joystick_del_all();
+seats_fini(unused sd_event_source *source, unused void *userdata) {
+    for (size_t n = 0; n < n_seats; ++n) {
+        seat *s = &g_seats[n];
+        if (g_config.system)
+            s->bus = sd_bus_flush_close_unref(s->bus);
+        free(s->session);
+        // joysticks removed later still report their seat
+        free(s->name);
+        s->name = NULL;
+    }
     return 0;
 }
 
 static int
-on_device_changed(sd_device_monitor *m, sd_device *d, unused void *userdata) {
-    int r;
+start(sd_bus *bus) {
+    sd_event *ev = sd_bus_get_event(bus);
 
-    const char *devname, *name;
-    r = joystick_probe(d, &devname, &name);
-    if (r <= 0)
-        return 0;
+    // hotplug monitor is nice to have, but not crytical to fail
+    udev_tag_init();
+    joystick_monitor_init(ev);
 
-    sd_device_action_t a;
-    r = sd_device_get_action(d, &a);
-    assert(r >= 0);
+    // every seat gets inhibitors of its active session
+    if (g_config.system)
+        return login_init(ev);
+
+    seat *s = seat_new(ev, NULL);
+    if (!s)
+        return -ENOMEM;
+    s->bus = bus;
+
+    watch_inhibitors(s, bus);
+    if (g_system_bus)
+        watch_inhibitors(s, g_system_bus);
+
+#ifdef HAVE_X11
+    x11_init(ev);
+#endif
 
-    sd_event *ev = sd_device_monitor_get_event(m);
-    switch (a) {
-        case SD_DEVICE_ADD:
-            joystick_add(ev, d, devname, name);
-            break;
-        case SD_DEVICE_REMOVE:
-            // no need to track device removal:
-            // read() fails with ENODEV first, so it's enough to handle it there
-        default:;
-    }
     return 0;
 }
 
 static int
-joystick_monitor_init(sd_event *ev) {
-    int r;
+on_timer(sd_event_source *source, unused uint64_t usec, void *userdata) {
+    seat *s = userdata;
+    assert(s->timer == source);
 
-    cleanup(sd_device_monitor_unrefp) sd_device_monitor *m = NULL;
-    r = sd_device_monitor_new(&m);
-    if (r < 0)
-        return log_error(r, "Failed to init udev monitor");
+    int r;
+    uint64_t now = g_replay_now;
+    if (!g_replay) {
+        r = sd_event_now(sd_event_source_get_event(source), CLOCK_MONOTONIC, &now);
+        assert(r >= 0);
+    }
+    PROBE(timer, s->name, s->policy.last_press, now);
 
-    r = sd_device_monitor_filter_add_match_subsystem_devtype(m, "input", NULL);
-    if (r < 0)
-        return log_error(r, "Failed to add subsystem match to udev monitor");
+    // presses queued while parked move the deadline too
+    joystick_unpark(s);
 
-    r = sd_device_monitor_attach_event(m, ev);
-    if (r < 0)
-        return log_error(r, "Failed to attach udev monitor");
+    metrics_changed();
+    if (policy_timer(&s->policy, now) & POLICY_ARM) {
+        seat_arm(s);
+        return 0;
+    }
 
-    g_monitor = sd_device_monitor_ref(m);
+    status_emit("deadline", s, NULL);
+    saver_sync(s, NULL);
     return 0;
 }
 
-static void
-joystick_monitor_start(void) {
-    if (!g_monitor)
-        return;
-
+static int
+on_idle(sd_event_source *s, unused uint64_t usec, unused void *userdata) {
     int r;
-    r = sd_device_monitor_start(g_monitor, on_device_changed, NULL);
-    if (r < 0) {
-        log_error(r, "Failed to start udev monitor");
-        g_monitor = sd_device_monitor_unref(g_monitor);
-    } else
-        log_infof("started joystick hotplug monitor...");
-}
 
-static void
-joystick_monitor_stop(void) {
-    if (!g_monitor)
-        return;
+    assert(is_idle());
+    // nothing tells us when those go away, look again later
+    if (joystick_plugged()) {
+        r = sd_event_source_set_time_relative(s, g_config.exit_idle);
+        if (r < 0)
+            return log_error(r, "Failed to reset the idle timer");
+        return sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+    }
 
-    int r;
-    r = sd_device_monitor_stop(g_monitor);
-    if (r < 0)
-        log_error(r, "Failed to stop udev monitor");
+    log_infof("no joysticks for %" PRIu64 "s, exiting", g_config.exit_idle / 1000000);
+    return sd_event_exit(sd_event_source_get_event(s), 0);
 }
 
 static int
-joystick_enumerate(sd_event *ev) {
+timer_init(sd_event *ev) {
     int r;
 
-    cleanup(sd_device_enumerator_unrefp) sd_device_enumerator *e;
-    r = sd_device_enumerator_new(&e);
+    r = sd_event_add_time_relative(ev, &g_idle, CLOCK_MONOTONIC,
+        g_config.exit_idle, g_config.exit_idle / 10, on_idle, NULL);
     if (r < 0)
-        return log_error(r, "Failed to create device enumerator");
+        return log_error(r, "Failed to initialize idle timer");
 
-    r = sd_device_enumerator_add_match_subsystem(e, "input", 1);
-    if (r < 0)
-        return log_error(r, "Failed to add subsystem match");
+    r = sd_event_source_set_enabled(g_idle, SD_EVENT_OFF);
+    assert(r >= 0);
 
-    int inputs = 0, joysticks = 0;
-    sd_device *d;
-    for (d = sd_device_enumerator_get_device_first(e);
-         d;
-         d = sd_device_enumerator_get_device_next(e))
-    {
-        ++inputs;
-        const char *devname, *name;
-        r = joystick_probe(d, &devname, &name);
-        if (r <= 0)
-            continue;
+    // the mode is picked at startup, the interval follows reloads
+    if (g_config.poll) {
+        r = sd_event_add_time_relative(ev, &g_poll, CLOCK_MONOTONIC,
+            g_config.poll, g_config.poll / 4, on_poll, NULL);
+        if (r < 0)
+            return log_error(r, "Failed to initialize poll timer");
 
-        ++joysticks;
-        joystick_add(ev, d, devname, name);
+        r = sd_event_source_set_enabled(g_poll, SD_EVENT_ON);
+        assert(r >= 0);
     }
 
-    log_infof("Found %d inputs, %d joysticks, %zd tracked",
-        inputs, joysticks, n_joysticks);
+    r = sd_event_add_time(ev, &g_recheck, CLOCK_MONOTONIC,
+        0, g_config.accuracy, on_recheck, NULL);
+    if (r < 0)
+        return log_error(r, "Failed to initialize recheck timer");
+
+    r = sd_event_source_set_enabled(g_recheck, SD_EVENT_OFF);
+    assert(r >= 0);
+
+    r = sd_event_add_exit(ev, NULL, seats_fini, NULL);
+    assert(r >= 0);
+
     return 0;
 }
 
-static int
-on_screen_saver_appeared(sd_bus *bus) {
-    sd_event *ev = sd_bus_get_event(bus);
-    int r = joystick_enumerate(ev);
-    joystick_monitor_start();
-    return r;
+// devices of a replayed log. they have no fds, events come from the log
+// and the virtual clock follows their timestamps.
+#define MAX_REPLAY_DEVICES 256
+#define MAX_RECORD_SIZE (1 << 20)
+
+typedef struct replay_device {
+    joystick j;
+    char name[RECORD_NAME + 1];
+} replay_device;
+
+static replay_device g_replay_devices[MAX_REPLAY_DEVICES];
+static size_t n_replay_devices;
+
+static replay_device *
+replay_find(uint64_t devnum) {
+    for (size_t i = 0; i < n_replay_devices; ++i)
+        if (g_replay_devices[i].j.devnum == devnum)
+            return &g_replay_devices[i];
+    return NULL;
 }
 
 static int
-on_screen_saver_disappeared(unused sd_bus *bus) {
-    int r;
-
-    if (g_cookie) {
-        log_infof("stale cookie %u", g_cookie);
-        g_cookie = 0;
-
-        r = sd_event_source_set_enabled(g_timer, SD_EVENT_OFF);
-        assert(r >= 0);
+replay_device_add(seat *s, const record *h, const uint8_t *payload) {
+    const record_device *d = (const record_device *)payload;
+    if (h->size < sizeof(*d))
+        return -EBADMSG;
+
+    const size_t n_axes = __builtin_popcountll(d->tracked);
+    const struct input_absinfo *info = (const struct input_absinfo *)(d + 1);
+    if (h->size != sizeof(*d) + n_axes * sizeof(*info) || (d->tracked >> ABS_MISC))
+        return -EBADMSG;
+
+    // devnum is reused by a replugged device, or axis setup changed on reload
+    replay_device *rd = replay_find(h->devnum);
+    if (!rd) {
+        if (n_replay_devices == MAX_REPLAY_DEVICES)
+            return -E2BIG;
+        rd = &g_replay_devices[n_replay_devices++];
     }
 
-    // screen saver is gone, no need to read joysticks
-    joystick_monitor_stop();
-    joystick_del_all();
+    free(rd->j.input.axes);
+    snprintf(rd->name, sizeof(rd->name), "%.*s", (int)sizeof(d->name), d->name);
+    // park is off: the virtual clock always follows event timestamps
+    rd->j = (joystick){
+        .seat = s,
+        .devnum = h->devnum,
+        .devname = rd->name,
+        .name = rd->name,
+        .monotonic = 1,
+        .input.masked = d->masked,
+    };
+
+    // replay might be run with other axes settings than the recording
+    if (g_config.axes)
+        for (unsigned c = 0; c < ABS_MISC; ++c)
+            if ((d->tracked & (1ULL << c)) && joystick_axis_add(&rd->j, c, info++) < 0)
+                return -ENOMEM;
+
+    log_infof("+%zd: %s mask=%s axes=%d", rd - g_replay_devices, rd->name,
+        rd->j.input.masked ? "on" : "off", rd->j.input.axes ? __builtin_popcountll(rd->j.input.axes->tracked) : 0);
     return 0;
 }
 
-static int
-on_name_owner_changed(sd_bus_message *m,
-    unused void *userdata,
-    unused sd_bus_error *ret_error)
-{
+// fires the deadline timer like the event loop would, if it is due by now.
+// the loop may fire it up to accuracy later, replay always does it right on time.
+static void
+replay_timer(seat *s, uint64_t now) {
     int r;
-    const char *name, *old_owner, *new_owner;
-    r = sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner);
-    if (r < 0)
-        return log_error(r, "Failed to read NameOwnerChanged reply");
 
-    if (strcmp(name, SAVER))
-        return 0;
+    while (s->policy.armed && s->policy.timer <= now) {
+        const uint64_t t = s->policy.timer;
+        if (t > g_replay_now)
+            g_replay_now = t;
 
-    sd_bus *bus = sd_bus_message_get_bus(m);
-    if (!new_owner || !new_owner[0]) {
-        log_info("screen saver disappeared");
-        return on_screen_saver_disappeared(bus);
-    } else {
-        log_info("screen saver appeared");
-        return on_screen_saver_appeared(bus);
+        // oneshot sources are disabled before dispatch, on_timer() re-arms it if needed
+        r = sd_event_source_set_enabled(s->timer, SD_EVENT_OFF);
+        assert(r >= 0);
+        on_timer(s->timer, t, s);
     }
 }
 
+// feeds a --record log through the same classification and timer logic as the daemon,
+// as fast as it can be read. decisions only depend on the log and config, so they
+// are reproducible, and inhibit calls go to a stub which prints them.
 static int
-watch_screen_saver(sd_bus *bus) {
-    int r;
+replay(sd_event *ev, const char *path) {
+    int r = 0;
+
+    cleanup(fclosep) FILE *f = fopen(path, "re");
+    if (!f)
+        return log_errorf(-errno, "Failed to open %s", path);
+
+    const record_file expected = { RECORD_MAGIC, sizeof(struct input_event), 0 };
+    record_file header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(&header, &expected, sizeof(header)))
+        return log_errorf(-EINVAL, "%s is not a record log of this machine", path);
+
+    g_config.park = 0;
+    seat *s = seat_new(ev, NULL);
+    if (!s)
+        return -ENOMEM;
+
+    cleanup(freep) uint8_t *buf = NULL;
+    size_t buf_size = 0;
+    replay_device *last = NULL;
+    uint64_t n_events = 0, n_batches = 0, n_skipped = 0, first = 0;
+
+    // wall clock, taken before the virtual one replaces it
+    const uint64_t start = now_usec();
+    g_replay = 1;
+
+    record h;
+    while (fread(&h, sizeof(h), 1, f) == 1) {
+        if (h.size > MAX_RECORD_SIZE) {
+            r = -EBADMSG;
+            break;
+        }
+        if (h.size > buf_size) {
+            uint8_t *p = realloc(buf, h.size);
+            if (!p) {
+                r = -ENOMEM;
+                break;
+            }
+            buf = p;
+            buf_size = h.size;
+        }
+        if (h.size && fread(buf, h.size, 1, f) != 1) {
+            r = -EBADMSG;
+            break;
+        }
+
+        if (h.type == RECORD_DEVICE) {
+            r = replay_device_add(s, &h, buf);
+            if (r < 0)
+                break;
+            continue;
+        }
+        if (h.type == RECORD_KEYS) {
+            unsigned long keys[NLONGS(KEY_CNT)];
+            if (h.size != sizeof(keys)) {
+                r = -EBADMSG;
+                break;
+            }
+            memcpy(keys, buf, sizeof(keys));
+            replay_device *rd = replay_find(h.devnum);
+            const uint64_t pressed = rd && rd->j.input.dropped ? input_resync(&rd->j.input, keys) : 0;
+            if (pressed)
+                joystick_activity(&rd->j, pressed);
+            continue;
+        }
+        if (h.type != RECORD_EVENTS)
+            continue;
+
+        const size_t count = h.size / sizeof(struct input_event);
+        if (h.size % sizeof(struct input_event)) {
+            r = -EBADMSG;
+            break;
+        }
+        if (!last || last->j.devnum != h.devnum)
+            last = replay_find(h.devnum);
+        if (!last || !count) {
+            n_skipped += count;
+            continue;
+        }
+
+        // the batch was read right after its last event
+        const struct input_event *events = (const struct input_event *)buf;
+        const uint64_t t = event_usec(&events[count - 1]);
+        replay_timer(s, t);
+        if (t > g_replay_now)
+            g_replay_now = t;
+        if (!first)
+            first = g_replay_now;
+
+        const uint64_t pressed = joystick_classify(&last->j, events, count);
+        if (pressed)
+            joystick_activity(&last->j, pressed);
+        n_events += count;
+        ++n_batches;
+    }
 
-    r = sd_bus_match_signal(bus, NULL, DBUS, DBUS_PATH, DBUS, "NameOwnerChanged",
-        on_name_owner_changed, NULL);
     if (r < 0)
-        log_error(r, "Failed to add NameOwnerChanged match");
+        log_errorf(r, "Failed to replay %s at offset %ld", path, ftell(f));
+    else if (ferror(f))
+        r = log_errorf(-EIO, "Failed to read %s", path);
+
+    // let the last deadline pass
+    replay_timer(s, UINT64_MAX);
+    g_replay = 0;
+    const uint64_t elapsed = now_usec() - start;
+
+    uint64_t n_presses = 0;
+    for (size_t i = 0; i < n_replay_devices; ++i) {
+        n_presses += g_replay_devices[i].j.input.n_presses;
+        free(g_replay_devices[i].j.input.axes);
+    }
 
-    return 0;
+    log_infof("replayed %" PRIu64 " events in %" PRIu64 " batches of %zu devices in %.3fs, %.2fM events/s",
+        n_events, n_batches, n_replay_devices, elapsed / 1e6, elapsed ? (double)n_events / elapsed : 0.0);
+    if (n_skipped)
+        log_infof("skipped %" PRIu64 " events of unknown devices", n_skipped);
+    log_infof("presses=%" PRIu64 " inhibit=%" PRIu64 " uninhibit=%" PRIu64 " inhibited=%.1fs of %.1fs",
+        n_presses, g_metrics.n_inhibit, g_metrics.n_uninhibit, g_metrics.inhibited_usec / 1e6,
+        first ? (g_replay_now - first) / 1e6 : 0.0);
+
+    return r;
 }
 
-static int
-start(sd_bus *bus) {
+// apply new configuration to the running daemon: live timer is adjusted in place,
+// and only devices affected by changed ignore patterns are closed or opened.
+static void
+config_apply(sd_event *ev, config *c) {
     int r;
 
-    r = saver_is_active(bus);
-    if (r < 0)
-        return r;
+    if (c->uring != g_config.uring)
+        log_info("backend change takes effect after restart");
+    if (c->system != g_config.system)
+        log_info("system mode change takes effect after restart");
+    if (!c->poll != !g_config.poll) {
+        log_info("poll mode change takes effect after restart");
+        c->poll = g_config.poll;
+    }
+    // it is only read at startup, keep it consistent with the running daemon
+    c->system = g_config.system;
 
-    // hotplug monitor is nice to have, but not crytical to fail
-    joystick_monitor_init(sd_bus_get_event(bus));
+    const int axes_changed = c->axes != g_config.axes
+        || c->deadzone != g_config.deadzone || c->threshold != g_config.threshold;
 
-    if (r)
-        on_screen_saver_appeared(bus);
-    else
-        log_info("waiting for screen saver to appear...");
+    config_free(&g_config);
+    g_config = *c;
 
-    return watch_screen_saver(bus);
-}
+    // masks and ranges are per open file, so devices don't have to be reopened
+    if (axes_changed)
+        for (size_t i = 0; i < n_joysticks; ++i)
+            joystick_axes_init(&g_joysticks[i]);
 
-static int
-on_timer(sd_event_source *s, unused uint64_t usec, void *userdata) {
-    sd_bus *bus = userdata;
-    assert(g_bus == bus);
-    assert(g_timer == s);
-    assert(g_cookie);
+    for (size_t n = 0; n < n_seats; ++n) {
+        seat *s = &g_seats[n];
+        r = sd_event_source_set_time_accuracy(s->timer, g_config.accuracy);
+        if (r < 0)
+            log_error(r, "Failed to set timer accuracy");
 
-    return saver_uninhibit(bus, &g_cookie);
+        if (policy_set_timeout(&s->policy, g_config.timeout) & POLICY_ARM)
+            seat_arm(s);
+    }
+
+    if (!g_config.park)
+        joystick_unpark(NULL);
+
+    if (g_poll) {
+        r = sd_event_source_set_time_accuracy(g_poll, g_config.poll / 4);
+        if (r < 0)
+            log_error(r, "Failed to set poll timer accuracy");
+    }
+
+    // go backwards: removal moves the last joystick into freed slot
+    for (size_t i = n_joysticks; i-- > 0;) {
+        joystick *j = &g_joysticks[i];
+        if (config_ignored(j->devname, j->name))
+            joystick_del(j);
+    }
+
+    // devices which are not ignored anymore. already tracked ones are skipped by joystick_add()
+    if (g_saver_present)
+        joystick_enumerate(ev);
+
+    // inhibitor setting might have changed
+    if (g_bus) {
+        inhibitors_changed();
+        for (size_t n = 0; n < n_seats; ++n)
+            saver_sync(&g_seats[n], NULL);
+    }
+
+    // restart the countdown with the new exit-idle value
+    if (g_idle) {
+        r = sd_event_source_set_enabled(g_idle, SD_EVENT_OFF);
+        assert(r >= 0);
+        idle_check();
+    }
+
+    metrics_changed();
 }
 
 static int
-timer_init(sd_event *ev, sd_bus *bus) {
+on_reload(sd_event_source *s, unused const struct signalfd_siginfo *si, unused void *userdata) {
     int r;
 
-    r = sd_event_add_time_relative(ev, &g_timer, CLOCK_MONOTONIC,
-        g_inhibit_timeout, accuracy, on_timer, bus);
-    if (r < 0)
-        return log_error(r, "Failed to initialize timerfd");
-
-    r = sd_event_source_set_enabled(g_timer, SD_EVENT_OFF);
-    assert(r >= 0);
+    config c;
+    r = config_load(&c);
+    if (r < 0) {
+        config_free(&c);
+        log_info("keeping previous configuration");
+        return 0;
+    }
 
+    config_apply(sd_event_source_get_event(s), &c);
+    log_infof("configuration reloaded: timeout=%" PRIu64 "s accuracy=%" PRIu64 "s park=%s ignore=%zu",
+        g_config.timeout / 1000000, g_config.accuracy / 1000000,
+        g_config.park ? "yes" : "no", g_config.n_ignore);
     return 0;
 }
 
@@ -533,8 +3461,9 @@ static int
 bus_init(sd_event_source *s, unused void *userdata) {
     int r;
 
+    // system mode reaches session buses on its own, see seat_connect()
     sd_bus *bus = NULL;
-    r = sd_bus_default_user(&bus);
+    r = g_config.system ? sd_bus_default_system(&bus) : sd_bus_default_user(&bus);
     if (r < 0)
         return log_error(r, "Can't connect do D-Bus");
 
@@ -546,15 +3475,38 @@ bus_init(sd_event_source *s, unused void *userdata) {
     if (r < 0)
         return log_error(r, "Failed to attach D-Bus to event loop");
 
-    r = timer_init(ev, bus);
+    r = timer_init(ev);
     if (r < 0)
         return r;
 
     assert(!g_bus);
     g_bus = bus;
 
+    // logind lives on the system bus, the other inhibitors don't need it
+    sd_bus *system = NULL;
+    if (g_config.system)
+        g_system_bus = bus;
+    else if ((r = sd_bus_default_system(&system)) < 0)
+        log_error(r, "Can't connect to system D-Bus");
+    else {
+        r = sd_event_add_exit(ev, NULL, bus_fini, system);
+        assert(r >= 0);
+
+        r = sd_bus_attach_event(system, ev, SD_EVENT_PRIORITY_NORMAL);
+        if (r < 0)
+            log_error(r, "Failed to attach system D-Bus to event loop");
+        else
+            g_system_bus = system;
+    }
+
+    // metrics are nice to have, but not critical to fail
+    metrics_init(bus);
+
     start(bus);
 
+    // nothing might turn up at all
+    idle_check();
+
     return 0;
 }
 
@@ -566,6 +3518,8 @@ signal_init(sd_event *ev) {
     sigemptyset(&s);
     sigaddset(&s, SIGINT);
     sigaddset(&s, SIGTERM);
+    sigaddset(&s, SIGUSR1);
+    sigaddset(&s, SIGHUP);
     sigprocmask(SIG_BLOCK, &s, NULL);
 
     // Stop event loop on a signal, exit handlers will take care of allocated resources
@@ -573,27 +3527,194 @@ signal_init(sd_event *ev) {
     assert(r >= 0);
     r = sd_event_add_signal(ev, NULL, SIGTERM, NULL, NULL);
     assert(r >= 0);
+
+    r = sd_event_add_signal(ev, NULL, SIGUSR1, on_latency_dump, NULL);
+    assert(r >= 0);
+
+    r = sd_event_add_signal(ev, NULL, SIGHUP, on_reload, NULL);
+    assert(r >= 0);
+}
+
+static void
+usage(const char *argv0) {
+    fprintf(stdout,
+        "usage: %s [options]\n"
+        "  -c, --config FILE      config file (default: $XDG_CONFIG_HOME/%s.conf)\n"
+        "  -t, --timeout SEC      inhibit screen saver for SEC after the last press (%" PRIu64 ")\n"
+        "  -a, --accuracy SEC     timer slack (%" PRIu64 ")\n"
+        "  -i, --ignore PATTERN   ignore devices with matching name or node, may be repeated\n"
+        "      --park, --no-park  stop polling joysticks until the inhibit deadline (yes)\n"
+        "      --poll SEC         sample button and axis state every SEC instead of reading events (0)\n"
+        "      --axes, --no-axes  count analog stick, pedal and d-pad movements as activity (no)\n"
+        "      --deadzone PCT     part of axis range around rest position ignored as noise (%d)\n"
+        "      --threshold PCT    part of axis range an axis has to move to count (%d)\n"
+        "  -b, --backend NAME     read joysticks with epoll or io_uring (epoll)\n"
+        "  -I, --inhibitor NAME   auto, logind, screensaver, gnome or x11 (auto)\n"
+        "      --exit-idle SEC    exit after SEC without joysticks, 0 to stay (0)\n"
+        "      --system           serve active sessions of all seats, run as root\n"
+        "      --record FILE      append joystick events to FILE for --replay\n"
+        "      --replay FILE      run events of FILE through inhibit logic offline and exit\n"
+        "      --status-fd FD     write a JSON line to FD on every device, inhibit and deadline change\n"
+        "      --status-fifo PATH the same, to a fifo created at PATH\n"
+        "  -h, --help             show this help\n"
+        "\n"
+        "Config file takes the same long options as key = value lines.\n"
+        "It is re-read on SIGHUP, command line options take precedence.\n",
+        argv0, PROJECT_NAME,
+        config_defaults.timeout / 1000000, config_defaults.accuracy / 1000000,
+        config_defaults.deadzone, config_defaults.threshold);
+}
+
+static int
+parse_argv(int argc, char **argv) {
+    static const struct option options[] = {
+        { "config",    required_argument, NULL, 'c' },
+        { "timeout",   required_argument, NULL, 't' },
+        { "accuracy",  required_argument, NULL, 'a' },
+        { "ignore",    required_argument, NULL, 'i' },
+        { "park",      no_argument,       NULL, 'p' },
+        { "no-park",   no_argument,       NULL, 'P' },
+        { "poll",      required_argument, NULL, 'o' },
+        { "axes",      no_argument,       NULL, 'x' },
+        { "no-axes",   no_argument,       NULL, 'X' },
+        { "deadzone",  required_argument, NULL, 'z' },
+        { "threshold", required_argument, NULL, 'T' },
+        { "backend",   required_argument, NULL, 'b' },
+        { "inhibitor", required_argument, NULL, 'I' },
+        { "exit-idle", required_argument, NULL, 'e' },
+        { "system",    no_argument,       NULL, 'S' },
+        { "record",    required_argument, NULL, 'R' },
+        { "replay",    required_argument, NULL, 'Y' },
+        { "status-fd",   required_argument, NULL, 'F' },
+        { "status-fifo", required_argument, NULL, 'f' },
+        { "help",      no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int c, i;
+    while ((c = getopt_long(argc, argv, "c:t:a:i:b:I:h", options, &i)) != -1) {
+        const char *key = NULL, *value = optarg;
+        switch (c) {
+            case 'c':
+                g_config_path = optarg;
+                g_config_required = 1;
+                continue;
+            case 'R':
+                g_record_path = optarg;
+                continue;
+            case 'Y':
+                g_replay_path = optarg;
+                continue;
+            case 'F': {
+                char *end;
+                errno = 0;
+                const long fd = strtol(optarg, &end, 10);
+                if (errno || end == optarg || *end || fd < 0 || fd > INT_MAX)
+                    return -EINVAL;
+                g_status_fd = fd;
+                continue;
+            }
+            case 'f':
+                g_status_fifo = optarg;
+                continue;
+            case 't': key = "timeout"; break;
+            case 'a': key = "accuracy"; break;
+            case 'i': key = "ignore"; break;
+            case 'b': key = "backend"; break;
+            case 'I': key = "inhibitor"; break;
+            case 'e': key = "exit-idle"; break;
+            case 'S': key = "system"; value = "yes"; break;
+            case 'p': key = "park"; value = "yes"; break;
+            case 'P': key = "park"; value = "no"; break;
+            case 'o': key = "poll"; break;
+            case 'x': key = "axes"; value = "yes"; break;
+            case 'X': key = "axes"; value = "no"; break;
+            case 'z': key = "deadzone"; break;
+            case 'T': key = "threshold"; break;
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+            default:
+                return -EINVAL;
+        }
+
+        if (n_overrides == MAX_OVERRIDES)
+            return -E2BIG;
+        g_overrides[n_overrides][0] = key;
+        g_overrides[n_overrides][1] = value;
+        ++n_overrides;
+    }
+
+    if (optind < argc) {
+        log_infof("%s: unexpected argument %s", argv[0], argv[optind]);
+        return -EINVAL;
+    }
+
+    if (g_record_path && g_replay_path) {
+        log_infof("%s: --record and --replay can't be used together", argv[0]);
+        return -EINVAL;
+    }
+
+    if (g_status_fd >= 0 && g_status_fifo) {
+        log_infof("%s: --status-fd and --status-fifo can't be used together", argv[0]);
+        return -EINVAL;
+    }
+
+    if (!g_config_path) {
+        static char path[PATH_MAX];
+        const char *xdg = getenv("XDG_CONFIG_HOME"), *home = getenv("HOME");
+        if (xdg && xdg[0])
+            snprintf(path, sizeof(path), "%s/%s.conf", xdg, PROJECT_NAME);
+        else if (home && home[0])
+            snprintf(path, sizeof(path), "%s/.config/%s.conf", home, PROJECT_NAME);
+        if (path[0])
+            g_config_path = path;
+    }
+
+    return 0;
 }
 
 int
 main(int argc, char **argv) {
-    if (argc != 1) {
-        log_infof("%s takes no arguments", argv[0]);
+    cleanup(sd_event_unrefp) sd_event *ev = NULL;
+    int r;
+
+    r = parse_argv(argc, argv);
+    if (r < 0) {
+        usage(argv[0]);
         return 1;
     }
 
-    cleanup(sd_event_unrefp) sd_event *ev = NULL;
-    int r;
+    r = config_load(&g_config);
+    if (r < 0)
+        return 1;
 
     r = sd_event_default(&ev);
     if (r < 0)
         return log_error(r, "Failed to allocate event loop");
 
+    if (status_open() < 0)
+        return 1;
+
+    if (g_replay_path)
+        return replay(ev, g_replay_path) < 0;
+
+    if (g_record_path && record_open(g_record_path) < 0)
+        return 1;
+
     signal_init(ev);
 
+#ifdef HAVE_LIBURING
+    if (g_config.uring && uring_init(ev) < 0)
+        log_info("falling back to epoll backend");
+#endif
+
     r = sd_event_add_exit(ev, NULL, joystick_exit, NULL);
     assert(r >= 0);
 
+    r = sd_event_add_exit(ev, NULL, latency_exit, NULL);
+    assert(r >= 0);
+
     r = sd_event_add_defer(ev, NULL, bus_init, NULL);
     if (r < 0)
         return log_error(r, "Failed to add event loop job");
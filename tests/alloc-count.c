@@ -0,0 +1,60 @@
+// Counts heap allocations of the whole process for joynosleep-alloc test build.
+// Definitions in the executable take precedence over libc ones for every
+// shared library too, so allocations made by libsystemd are counted as well.
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *p);
+
+uint64_t alloc_count;
+
+void *
+malloc(size_t size) {
+    ++alloc_count;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size) {
+    ++alloc_count;
+    return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *p, size_t size) {
+    ++alloc_count;
+    return __libc_realloc(p, size);
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size) {
+    ++alloc_count;
+    return __libc_memalign(alignment, size);
+}
+
+void *
+memalign(size_t alignment, size_t size) {
+    ++alloc_count;
+    return __libc_memalign(alignment, size);
+}
+
+int
+posix_memalign(void **p, size_t alignment, size_t size) {
+    ++alloc_count;
+    void *m = __libc_memalign(alignment, size);
+    if (!m)
+        return ENOMEM;
+    *p = m;
+    return 0;
+}
+
+void
+free(void *p) {
+    __libc_free(p);
+}
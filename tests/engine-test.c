@@ -0,0 +1,322 @@
+// inhibit policy and classifier driven on a simulated clock
+#include "engine.h"
+
+// release builds check too
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SEC 1000000ULL
+
+static struct input_event
+event(uint64_t usec, uint16_t type, uint16_t code, int32_t value) {
+    struct input_event e = { .type = type, .code = code, .value = value };
+    e.input_event_sec = usec / SEC;
+    e.input_event_usec = usec % SEC;
+    return e;
+}
+
+static void
+test_deadline(void) {
+    policy p;
+    unsigned r;
+    policy_init(&p, 600 * SEC);
+    assert(policy_idle(&p));
+
+    // the first press arms the timer and inhibits
+    policy_press(&p, 10 * SEC);
+    r = policy_activity(&p);
+    assert(r == POLICY_ARM);
+    assert(p.timer == 610 * SEC);
+    r = policy_sync(&p, 1, 0);
+    assert(r == POLICY_INHIBIT);
+    r = policy_sync(&p, 1, 0);
+    assert(r == 0);
+    r = policy_inhibited(&p, 1);
+    assert(r == 0);
+    assert(p.state == SAVER_INHIBITED);
+
+    // later presses only move the deadline
+    policy_press(&p, 300 * SEC);
+    r = policy_activity(&p);
+    assert(r == 0);
+    r = policy_sync(&p, 1, 1);
+    assert(r == 0);
+
+    // the timer sleeps until the new deadline, then releases
+    r = policy_timer(&p, 610 * SEC);
+    assert(r == POLICY_ARM);
+    assert(p.timer == 900 * SEC);
+    r = policy_timer(&p, 900 * SEC);
+    assert(r == 0);
+    assert(!p.want_inhibit);
+    r = policy_sync(&p, 1, 1);
+    assert(r == POLICY_RELEASE);
+    r = policy_released(&p, 1);
+    assert(r == 0);
+    assert(policy_idle(&p));
+}
+
+static void
+test_retry(void) {
+    policy p;
+    unsigned r;
+    policy_init(&p, 600 * SEC);
+
+    // nothing to inhibit with: the press is remembered
+    policy_press(&p, SEC);
+    policy_activity(&p);
+    r = policy_sync(&p, 0, 0);
+    assert(r == 0);
+
+    // failures back off exponentially, nothing is called meanwhile
+    r = policy_sync(&p, 1, 0);
+    assert(r == POLICY_INHIBIT);
+    r = policy_inhibited(&p, 0);
+    assert(r == POLICY_RETRY);
+    assert(p.retry_delay == POLICY_RETRY_MIN);
+    r = policy_sync(&p, 1, 0);
+    assert(r == 0);
+    policy_retry(&p);
+    r = policy_sync(&p, 1, 0);
+    assert(r == POLICY_INHIBIT);
+    r = policy_failed(&p);
+    assert(r == POLICY_RETRY);
+    assert(p.retry_delay == 2 * POLICY_RETRY_MIN);
+    policy_retry(&p);
+    r = policy_sync(&p, 1, 0);
+    assert(r == POLICY_INHIBIT);
+    r = policy_inhibited(&p, 1);
+    assert(r == 0);
+    assert(p.retry_delay == 0);
+
+    // inhibitor is not allowed anymore: release it, then take another one
+    r = policy_sync(&p, 1, 0);
+    assert(r == POLICY_RELEASE);
+    r = policy_released(&p, 1);
+    assert(r == 0);
+    r = policy_sync(&p, 1, 0);
+    assert(r == POLICY_INHIBIT);
+
+    // shorter timeout moves the armed deadline
+    r = policy_set_timeout(&p, 60 * SEC);
+    assert(r == POLICY_ARM);
+    assert(p.timer == 61 * SEC);
+
+    policy_reset(&p);
+    assert(policy_idle(&p) && !p.armed);
+}
+
+static void
+test_classify(void) {
+    input in = {0};
+    uint64_t pressed;
+    int r;
+    const struct input_absinfo stick = { .minimum = -100, .maximum = 100, .value = 0 };
+    r = input_axis_add(&in, ABS_X, &stick, 10, 5);
+    assert(r == 0);
+
+    // jitter within threshold and deadzone is not activity
+    struct input_event noise[] = {
+        event(1 * SEC, EV_ABS, ABS_X, 4),
+        event(1 * SEC, EV_SYN, SYN_REPORT, 0),
+        event(2 * SEC, EV_ABS, ABS_X, 15),
+        event(2 * SEC, EV_SYN, SYN_REPORT, 0),
+    };
+    pressed = input_classify(&in, noise, 2);
+    assert(pressed == 0);
+    pressed = input_classify(&in, noise + 2, 2);
+    assert(pressed == 0);
+
+    // leaving the deadzone is
+    struct input_event move[] = {
+        event(3 * SEC, EV_ABS, ABS_X, 60),
+        event(3 * SEC, EV_SYN, SYN_REPORT, 0),
+    };
+    pressed = input_classify(&in, move, 2);
+    assert(pressed == 3 * SEC);
+
+    // buttons count on release
+    struct input_event press[] = {
+        event(4 * SEC, EV_KEY, BTN_SOUTH, 1),
+        event(5 * SEC, EV_KEY, BTN_SOUTH, 0),
+        event(5 * SEC, EV_SYN, SYN_REPORT, 0),
+    };
+    pressed = input_classify(&in, press, 1);
+    assert(pressed == 0);
+    pressed = input_classify(&in, press + 1, 2);
+    assert(pressed == 5 * SEC);
+    assert(in.n_presses == 1 && in.n_events == 9 && in.n_reads == 5);
+
+    free(in.axes);
+}
+
+static void
+test_resync(void) {
+    input in = {0};
+    uint64_t pressed;
+
+    // the frame around an overflow is discarded up to the next report
+    struct input_event events[] = {
+        event(1 * SEC, EV_KEY, BTN_SOUTH, 1),
+        event(1 * SEC, EV_SYN, SYN_REPORT, 0),
+        event(2 * SEC, EV_SYN, SYN_DROPPED, 0),
+        event(2 * SEC, EV_KEY, BTN_EAST, 0),
+        event(2 * SEC, EV_SYN, SYN_REPORT, 0),
+        event(3 * SEC, EV_KEY, BTN_EAST, 1),
+        event(3 * SEC, EV_SYN, SYN_REPORT, 0),
+    };
+    pressed = input_classify(&in, events, 7);
+    assert(pressed == 0);
+    assert(in.n_dropped == 1 && in.n_presses == 0);
+    assert(in.dropped == 2 * SEC);
+
+    // south went up in the overflow, east is down as seen after it
+    unsigned long keys[NLONGS(KEY_CNT)] = {0};
+    keys[BTN_EAST / BITS_PER_LONG] |= 1UL << (BTN_EAST % BITS_PER_LONG);
+    pressed = input_resync(&in, keys);
+    assert(pressed == 2 * SEC);
+    assert(in.n_missed == 1 && in.dropped == 0);
+
+    // nothing changed in the next one
+    struct input_event dropped = event(4 * SEC, EV_SYN, SYN_DROPPED, 0);
+    pressed = input_classify(&in, &dropped, 1);
+    assert(pressed == 0);
+    pressed = input_resync(&in, keys);
+    assert(pressed == 0);
+    assert(in.n_missed == 1);
+}
+
+static void
+test_chatter(void) {
+    input in = {0};
+    uint64_t pressed;
+    int r;
+    struct input_event e[2];
+
+    // a human: the same button, never at a steady period
+    for (uint64_t i = 0, t = SEC; i < 4 * CHATTER_RING; ++i, t += 150000 + i * 7000 % 50000) {
+        e[0] = event(t, EV_KEY, BTN_SOUTH, 0);
+        pressed = input_classify(&in, e, 1);
+        assert(pressed == t);
+    }
+    assert(!in.chatter.until && in.chatter.n_quarantines == 0);
+
+    // chords: four buttons let go in the same frame count once
+    input chord = {0};
+    for (uint64_t i = 0, t = SEC; i < 4 * CHATTER_RING; ++i, t += 60000 + i % 3 * 5000) {
+        for (unsigned b = 0; b < 4; ++b) {
+            e[0] = event(t, EV_KEY, BTN_SOUTH + b, 0);
+            input_classify(&chord, e, 1);
+        }
+    }
+    assert(!chord.chatter.until && chord.chatter.n_quarantines == 0);
+    assert(chord.n_presses == 4 * 4 * CHATTER_RING);
+
+    // a worn button toggling every 100ms is quarantined, presses of others still count
+    uint64_t t = 100 * SEC;
+    for (unsigned i = 0; i < CHATTER_PERIODIC; ++i, t += 100000) {
+        e[0] = event(t, EV_KEY, BTN_EAST, 0);
+        e[1] = event(t + 20000 + i % 3 * 7000, EV_KEY, BTN_SOUTH, 0);
+        pressed = input_classify(&in, e, 1);
+        assert(pressed == t);
+        input_classify(&in, e + 1, 1);
+    }
+    assert(in.chatter.changed && in.chatter.until == t - 100000 + CHATTER_RECHECK_MIN);
+    assert(test_bit(in.chatter.noisy, BTN_EAST) && !test_bit(in.chatter.noisy, BTN_SOUTH));
+    e[0] = event(t, EV_KEY, BTN_EAST, 0);
+    pressed = input_classify(&in, e, 1);
+    assert(pressed == 0 && in.chatter.n_ignored == 1);
+    e[0] = event(t, EV_KEY, BTN_SOUTH, 0);
+    pressed = input_classify(&in, e, 1);
+    assert(pressed == t);
+
+    // its key state doesn't count as missed presses either
+    unsigned long keys[NLONGS(KEY_CNT)] = {0};
+    in.keys[BTN_EAST / BITS_PER_LONG] |= 1UL << (BTN_EAST % BITS_PER_LONG);
+    in.dropped = t;
+    pressed = input_resync(&in, keys);
+    assert(pressed == 0 && in.n_missed == 0);
+
+    // lifted in time, a quarantine soon after is twice as long
+    in.chatter.changed = 0;
+    r = input_recheck(&in, in.chatter.until - 1);
+    assert(r == 0);
+    r = input_recheck(&in, in.chatter.until);
+    assert(r == 1);
+    assert(in.chatter.changed && !in.chatter.until && !test_bit(in.chatter.noisy, BTN_EAST));
+
+    // a device pressing a whole ring in no time is quarantined altogether
+    t = in.chatter.lifted + 10 * SEC;
+    for (unsigned i = 0; i < CHATTER_RING; ++i) {
+        t += 3000 + i % 3 * 2000;
+        e[0] = event(t, EV_KEY, BTN_SOUTH + i % 4, 0);
+        input_classify(&in, e, 1);
+    }
+    assert(in.chatter.until == t + 2 * CHATTER_RECHECK_MIN);
+    assert(test_bit(in.chatter.noisy, BTN_SOUTH) && test_bit(in.chatter.noisy, KEY_ESC));
+    assert(in.chatter.n_quarantines == 2);
+
+    // presses after the deadline lift it on their own
+    t = in.chatter.until;
+    e[0] = event(t, EV_KEY, BTN_SOUTH, 0);
+    pressed = input_classify(&in, e, 1);
+    assert(pressed == t && !in.chatter.until);
+
+    // clean for as long as the last quarantine: the next one starts over
+    t += 2 * CHATTER_RECHECK_MIN;
+    for (unsigned i = 0; i < CHATTER_PERIODIC; ++i, t += 100000) {
+        e[0] = event(t, EV_KEY, BTN_EAST, 0);
+        pressed = input_classify(&in, e, 1);
+        assert(pressed == t);
+    }
+    assert(in.chatter.until == t - 100000 + CHATTER_RECHECK_MIN);
+    assert(in.chatter.n_quarantines == 3);
+}
+
+static void
+test_sample(void) {
+    input in = {0};
+    uint64_t pressed;
+    int r;
+    const struct input_absinfo stick = { .minimum = -100, .maximum = 100, .value = 0 };
+    r = input_axis_add(&in, ABS_X, &stick, 10, 5);
+    assert(r == 0);
+
+    // a button held down is activity, and so is letting it go
+    unsigned long keys[NLONGS(KEY_CNT)] = {0};
+    pressed = input_sample(&in, keys, 1 * SEC);
+    assert(pressed == 0);
+    keys[BTN_SOUTH / BITS_PER_LONG] |= 1UL << (BTN_SOUTH % BITS_PER_LONG);
+    pressed = input_sample(&in, keys, 2 * SEC);
+    assert(pressed == 2 * SEC);
+    pressed = input_sample(&in, keys, 3 * SEC);
+    assert(pressed == 0);
+    keys[BTN_SOUTH / BITS_PER_LONG] = 0;
+    pressed = input_sample(&in, keys, 4 * SEC);
+    assert(pressed == 4 * SEC);
+    assert(in.n_presses == 1 && in.n_reads == 4);
+
+    // axes go through the same deadzone and threshold
+    in.axes->value[ABS_X] = 5;
+    pressed = input_sample(&in, keys, 5 * SEC);
+    assert(pressed == 0);
+    in.axes->value[ABS_X] = 60;
+    pressed = input_sample(&in, keys, 6 * SEC);
+    assert(pressed == 6 * SEC);
+
+    free(in.axes);
+}
+
+int
+main(void) {
+    test_deadline();
+    test_retry();
+    test_classify();
+    test_resync();
+    test_chatter();
+    test_sample();
+    printf("ok\n");
+    return 0;
+}